@@ -0,0 +1,505 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <sched.h>
+#include "memory-pool.h"
+#include "thread-pool.h"
+#include "channel.h"
+#include "../range/def.h"
+#include "../window/def.h"
+#include "../window/alloc.h"
+#include "../log/log.h"
+
+#define CACHE_LINE 64
+
+typedef struct {
+    atomic_size_t sequence;
+    void * item;
+}
+    channel_slot;
+
+struct thread_channel {
+    size_t mask;
+    char pad0[CACHE_LINE - sizeof(size_t)];
+    atomic_size_t enqueue;
+    char pad1[CACHE_LINE - sizeof(atomic_size_t)];
+    atomic_size_t dequeue;
+    char pad2[CACHE_LINE - sizeof(atomic_size_t)];
+    channel_slot slots[];
+};
+
+thread_channel * thread_channel_new(size_t capacity)
+{
+    size_t size = 2;
+
+    while (size < capacity)
+    {
+	size *= 2;
+    }
+
+    thread_channel * retval = calloc(1, sizeof(*retval) + size * sizeof(channel_slot));
+
+    if (!retval)
+    {
+	log_error("Failed to allocate a channel of %zu slots", size);
+	abort();
+    }
+
+    retval->mask = size - 1;
+
+    for (size_t i = 0; i < size; i++)
+    {
+	atomic_init(&retval->slots[i].sequence, i);
+    }
+
+    return retval;
+}
+
+void thread_channel_free(thread_channel * channel)
+{
+    free(channel);
+}
+
+static bool channel_send(thread_channel * channel, void * item, size_t * stamp)
+{
+    size_t position = atomic_load_explicit(&channel->enqueue, memory_order_relaxed);
+    channel_slot * slot;
+
+    while (true)
+    {
+	slot = &channel->slots[position & channel->mask];
+	size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+	intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+
+	if (difference == 0)
+	{
+	    if (atomic_compare_exchange_weak_explicit(&channel->enqueue, &position, position + 1, memory_order_seq_cst, memory_order_relaxed))
+	    {
+		break;
+	    }
+	}
+	else if (difference < 0)
+	{
+	    return false;
+	}
+	else
+	{
+	    position = atomic_load_explicit(&channel->enqueue, memory_order_relaxed);
+	}
+    }
+
+    if (stamp)
+    {
+	*stamp = position; // written before the item is published so receivers see it
+    }
+
+    slot->item = item;
+    atomic_store_explicit(&slot->sequence, position + 1, memory_order_release);
+
+    return true;
+}
+
+bool thread_channel_try_send(thread_channel * channel, void * item)
+{
+    return channel_send(channel, item, NULL);
+}
+
+bool thread_channel_try_receive(thread_channel * channel, void ** item)
+{
+    size_t position = atomic_load_explicit(&channel->dequeue, memory_order_relaxed);
+    channel_slot * slot;
+
+    while (true)
+    {
+	slot = &channel->slots[position & channel->mask];
+	size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+	intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+
+	if (difference == 0)
+	{
+	    if (atomic_compare_exchange_weak_explicit(&channel->dequeue, &position, position + 1, memory_order_seq_cst, memory_order_relaxed))
+	    {
+		break;
+	    }
+	}
+	else if (difference < 0)
+	{
+	    return false;
+	}
+	else
+	{
+	    position = atomic_load_explicit(&channel->dequeue, memory_order_relaxed);
+	}
+    }
+
+    *item = slot->item;
+    atomic_store_explicit(&slot->sequence, position + channel->mask + 1, memory_order_release);
+
+    return true;
+}
+
+size_t thread_channel_count(thread_channel * channel)
+{
+    size_t dequeue = atomic_load_explicit(&channel->dequeue, memory_order_seq_cst);
+    size_t enqueue = atomic_load_explicit(&channel->enqueue, memory_order_seq_cst);
+
+    return enqueue > dequeue ? enqueue - dequeue : 0;
+}
+
+typedef struct {
+    size_t sequence;
+    void * item;
+}
+    pipeline_envelope;
+
+thread_memory_pool_declare(pipeline_envelope, pipeline_envelope);
+thread_memory_pool_define_alloc(pipeline_envelope);
+thread_memory_pool_declare_default_alloc(pipeline_envelope);
+thread_memory_pool_define_default_alloc(pipeline_envelope);
+
+static pthread_once_t envelope_init_once = PTHREAD_ONCE_INIT;
+
+range_typedef(pipeline_envelope*,pipeline_envelope_p);
+window_typedef(pipeline_envelope*,pipeline_envelope_p);
+
+typedef struct {
+    thread_pipeline_function function;
+    void * context;
+    size_t parallelism;
+    size_t capacity;
+    thread_channel * input;
+    atomic_size_t active; /**< Threads draining the stage's channel */
+    atomic_size_t waking; /**< Queued jobs that will try to drain it */
+}
+    pipeline_stage;
+
+range_typedef(pipeline_stage,pipeline_stage);
+window_typedef(pipeline_stage,pipeline_stage);
+
+struct thread_pipeline {
+    bool ordered;
+    bool started;
+    window_pipeline_stage stages;
+    thread_job * done;
+    atomic_size_t references; /**< One for the open input and one per queued stage job, the last to go releases done */
+    size_t next_sequence; /**< Sequence the last stage of an ordered pipeline takes next */
+    window_pipeline_envelope_p early; /**< Envelopes that reached the last stage of an ordered pipeline ahead of their turn */
+};
+
+thread_job_declare(thread_pipeline_stage);
+thread_job_define_arg(thread_pipeline_stage, struct { thread_pipeline * pipeline; size_t index; });
+
+static pthread_once_t stage_job_init_once = PTHREAD_ONCE_INIT;
+
+thread_pipeline * thread_pipeline_new(bool ordered)
+{
+    thread_pipeline * retval = calloc(1, sizeof(*retval));
+
+    retval->ordered = ordered;
+
+    return retval;
+}
+
+void thread_pipeline_add_stage(thread_pipeline * pipeline, thread_pipeline_function function, void * context, size_t parallelism, size_t capacity)
+{
+    assert(!pipeline->started);
+    assert(parallelism);
+
+    *window_push(pipeline->stages) = (pipeline_stage){
+	.function = function,
+	.context = context,
+	.parallelism = parallelism,
+	.capacity = capacity,
+    };
+}
+
+inline static size_t stage_count(thread_pipeline * pipeline)
+{
+    return range_count(pipeline->stages.region);
+}
+
+inline static pipeline_stage * stage_at(thread_pipeline * pipeline, size_t index)
+{
+    return pipeline->stages.region.begin + index;
+}
+
+static void pipeline_release(thread_pool * pool, thread_pipeline * pipeline)
+{
+    if (atomic_fetch_sub(&pipeline->references, 1) != 1)
+    {
+	return;
+    }
+
+    assert(range_is_empty(pipeline->early.region));
+
+    if (pipeline->done)
+    {
+	thread_job_release(pool, pipeline->done);
+    }
+}
+
+static bool stage_claim(pipeline_stage * stage)
+{
+    size_t active = atomic_load(&stage->active);
+
+    do
+    {
+	if (active >= stage->parallelism)
+	{
+	    return false;
+	}
+    }
+    while (!atomic_compare_exchange_weak(&stage->active, &active, active + 1));
+
+    return true;
+}
+
+static void stage_drain(thread_pool * pool, thread_pipeline * pipeline, size_t index);
+
+static void stage_wake(thread_pool * pool, thread_pipeline * pipeline, size_t index)
+{
+    pipeline_stage * stage = stage_at(pipeline, index);
+    size_t waking = atomic_load(&stage->waking);
+
+    do
+    {
+	if (waking + atomic_load(&stage->active) >= stage->parallelism)
+	{
+	    return; // whoever holds the stage checks its channel again before letting go
+	}
+    }
+    while (!atomic_compare_exchange_weak(&stage->waking, &waking, waking + 1));
+
+    atomic_fetch_add(&pipeline->references, 1);
+
+    pthread_once(&stage_job_init_once, thread_pipeline_stage_job_memory_calloc_init);
+
+    thread_pipeline_stage_job * job = thread_pipeline_stage_job_memory_calloc();
+    *thread_pipeline_stage_job_init(job) = (thread_pipeline_stage_job_arg){ pipeline, index };
+
+    if (!thread_pool_add_thread_pipeline_stage_job(pool, job))
+    {
+	thread_pipeline_stage_job_memory_free(job); // the pool is full and fails rather than waits, drain here instead
+	
+	atomic_fetch_sub(&stage->waking, 1);
+
+	if (stage_claim(stage))
+	{
+	    stage_drain(pool, pipeline, index);
+	}
+
+	pipeline_release(pool, pipeline);
+    }
+}
+
+static void envelope_free(pipeline_envelope * envelope)
+{
+    pipeline_envelope_memory_lock(envelope);
+    pipeline_envelope_memory_free(envelope);
+}
+
+static void stage_forward(thread_pool * pool, thread_pipeline * pipeline, size_t index, pipeline_envelope * envelope)
+{
+    pipeline_stage * next = stage_at(pipeline, index + 1);
+
+    while (!thread_channel_try_send(next->input, envelope))
+    {
+	// only ever wait on stages further down, which always make progress, rather than run arbitrary jobs here
+	if (stage_claim(next))
+	{
+	    stage_drain(pool, pipeline, index + 1);
+	}
+	else
+	{
+	    sched_yield();
+	}
+    }
+
+    stage_wake(pool, pipeline, index + 1);
+}
+
+static void stage_process(thread_pool * pool, thread_pipeline * pipeline, size_t index, pipeline_envelope * envelope)
+{
+    pipeline_stage * stage = stage_at(pipeline, index);
+
+    if (envelope->item)
+    {
+	envelope->item = stage->function(pool, envelope->item, stage->context);
+    }
+
+    if (index + 1 == stage_count(pipeline) || (!envelope->item && !pipeline->ordered))
+    {
+	envelope_free(envelope);
+    }
+    else
+    {
+	stage_forward(pool, pipeline, index, envelope); // dropped items of an ordered pipeline still pass through to keep the sequence
+    }
+}
+
+static void stage_deliver_ordered(thread_pool * pool, thread_pipeline * pipeline, size_t index, pipeline_envelope * envelope)
+{
+    if (envelope->sequence != pipeline->next_sequence)
+    {
+	*window_push(pipeline->early) = envelope;
+	return;
+    }
+
+    stage_process(pool, pipeline, index, envelope);
+    pipeline->next_sequence++;
+
+    pipeline_envelope ** i;
+
+    for (i = pipeline->early.region.begin; i < pipeline->early.region.end;)
+    {
+	if ((*i)->sequence != pipeline->next_sequence)
+	{
+	    i++;
+	    continue;
+	}
+
+	envelope = *i;
+	*i = *--pipeline->early.region.end;
+	stage_process(pool, pipeline, index, envelope);
+	pipeline->next_sequence++;
+	i = pipeline->early.region.begin;
+    }
+}
+
+static void stage_drain(thread_pool * pool, thread_pipeline * pipeline, size_t index)
+{
+    pipeline_stage * stage = stage_at(pipeline, index);
+    bool ordered = pipeline->ordered && index + 1 == stage_count(pipeline);
+    void * item;
+
+    do
+    {
+	while (thread_channel_try_receive(stage->input, &item))
+	{
+	    if (ordered)
+	    {
+		stage_deliver_ordered(pool, pipeline, index, item);
+	    }
+	    else
+	    {
+		stage_process(pool, pipeline, index, item);
+	    }
+	}
+
+	atomic_fetch_sub(&stage->active, 1);
+    }
+    while (thread_channel_count(stage->input) && stage_claim(stage)); // a sender may have found the stage at its limit just before this let go
+}
+
+thread_job_define_function(thread_pipeline_stage)
+{
+    pipeline_stage * stage = stage_at(arg->pipeline, arg->index);
+    
+    atomic_fetch_sub(&stage->waking, 1);
+
+    if (stage_claim(stage))
+    {
+	stage_drain(pool, arg->pipeline, arg->index);
+    }
+
+    pipeline_release(pool, arg->pipeline);
+}
+
+void thread_pipeline_start(thread_pipeline * pipeline, thread_job * done)
+{
+    assert(!pipeline->started);
+
+    if (range_is_empty(pipeline->stages.region))
+    {
+	log_error("Started a pipeline without stages");
+	abort();
+    }
+
+    pipeline->started = true;
+
+    pipeline_stage * stage;
+
+    for_range(stage, pipeline->stages.region)
+    {
+	stage->input = thread_channel_new(stage->capacity);
+    }
+
+    if (pipeline->ordered)
+    {
+	stage_at(pipeline, stage_count(pipeline) - 1)->parallelism = 1;
+    }
+
+    pipeline->done = done;
+    atomic_store(&pipeline->references, 1);
+
+    if (done)
+    {
+	thread_job_add_dependency(done);
+	thread_job_memory_unlock(done);
+    }
+}
+
+bool thread_pipeline_try_push(thread_pool * pool, thread_pipeline * pipeline, void * item)
+{
+    assert(pipeline->started);
+    assert(item);
+
+    pthread_once(&envelope_init_once, pipeline_envelope_memory_calloc_init);
+
+    pipeline_envelope * envelope = pipeline_envelope_memory_calloc();
+    pipeline_envelope_memory_unlock(envelope);
+    envelope->item = item;
+
+    if (!channel_send(stage_at(pipeline, 0)->input, envelope, &envelope->sequence))
+    {
+	envelope_free(envelope);
+	return false;
+    }
+
+    stage_wake(pool, pipeline, 0);
+
+    return true;
+}
+
+void thread_pipeline_push(thread_pool * pool, thread_pipeline * pipeline, void * item)
+{
+    while (!thread_pipeline_try_push(pool, pipeline, item))
+    {
+	if (stage_claim(stage_at(pipeline, 0)))
+	{
+	    stage_drain(pool, pipeline, 0);
+	}
+	else
+	{
+	    sched_yield();
+	}
+    }
+}
+
+void thread_pipeline_close(thread_pool * pool, thread_pipeline * pipeline)
+{
+    assert(pipeline->started);
+
+    pipeline_release(pool, pipeline);
+}
+
+void thread_pipeline_free(thread_pipeline * pipeline)
+{
+    pipeline_stage * stage;
+
+    for_range(stage, pipeline->stages.region)
+    {
+	if (stage->input)
+	{
+	    assert(!thread_channel_count(stage->input));
+	    thread_channel_free(stage->input);
+	}
+    }
+
+    window_clear(pipeline->stages);
+    window_clear(pipeline->early);
+    free(pipeline);
+}
@@ -0,0 +1,71 @@
+#ifndef FLAT_INCLUDES
+#include <stddef.h>
+#include <stdbool.h>
+#include "memory-pool.h"
+#include "thread-pool.h"
+#endif
+
+typedef struct thread_channel thread_channel;
+typedef struct thread_pipeline thread_pipeline;
+
+thread_channel * thread_channel_new(size_t capacity);
+/**<
+   Creates a lock-free bounded channel of pointers for any number of senders and receivers. The capacity is rounded up to a power of two
+*/
+
+void thread_channel_free(thread_channel * channel);
+
+bool thread_channel_try_send(thread_channel * channel, void * item);
+/**<
+   Queues an item, returning false if the channel is full
+*/
+
+bool thread_channel_try_receive(thread_channel * channel, void ** item);
+/**<
+   Takes the oldest item, returning false if the channel is empty
+*/
+
+size_t thread_channel_count(thread_channel * channel);
+/**<
+   Returns the number of items sent and not yet received, which may be stale as soon as it returns
+*/
+
+typedef void * (*thread_pipeline_function)(thread_pool * pool, void * item, void * context);
+/**<
+   Transforms an item for the next stage. Returning NULL drops the item. The return value of the last stage is ignored
+*/
+
+thread_pipeline * thread_pipeline_new(bool ordered);
+/**<
+   Creates an empty pipeline. An ordered pipeline hands items to its last stage in the order they were pushed, and runs that stage one item at a time
+*/
+
+void thread_pipeline_add_stage(thread_pipeline * pipeline, thread_pipeline_function function, void * context, size_t parallelism, size_t capacity);
+/**<
+   Appends a stage that runs on up to parallelism jobs at once, fed by a channel of the given capacity. Stages are added before the pipeline is started
+*/
+
+void thread_pipeline_start(thread_pipeline * pipeline, thread_job * done);
+/**<
+   Makes the pipeline ready for items. The done job, which may be NULL, is given a dependency and unlocked, and is released once the pipeline is closed and every item has left the last stage
+*/
+
+bool thread_pipeline_try_push(thread_pool * pool, thread_pipeline * pipeline, void * item);
+/**<
+   Feeds a non-NULL item to the first stage, returning false if its channel is full
+*/
+
+void thread_pipeline_push(thread_pool * pool, thread_pipeline * pipeline, void * item);
+/**<
+   Feeds a non-NULL item to the first stage, draining it on the calling thread while its channel is full
+*/
+
+void thread_pipeline_close(thread_pool * pool, thread_pipeline * pipeline);
+/**<
+   Marks the end of the input. Must follow the return of the last push
+*/
+
+void thread_pipeline_free(thread_pipeline * pipeline);
+/**<
+   Frees a pipeline once its done job has been released
+*/
@@ -0,0 +1,142 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include "memory-pool.h"
+#include "thread-pool.h"
+#include "future.h"
+#include "../log/log.h"
+
+thread_memory_pool_declare_alloc(thread_future);
+thread_memory_pool_declare_concurrency(thread_future);
+
+struct thread_future {
+    size_t value_size;
+    bool ready;
+    thread_job * continuation;
+};
+
+inline static void * future_value(thread_future * future)
+{
+    return future + 1;
+}
+
+thread_future_memory_pool * thread_future_memory_pool_new(size_t value_size)
+{
+    return (thread_future_memory_pool*) thread_memory_pool_new(sizeof(thread_future) + value_size);
+}
+
+thread_future_memory_pool * thread_future_memory_pool_new_options(size_t value_size, const thread_memory_pool_options * options)
+{
+    return (thread_future_memory_pool*) thread_memory_pool_new_options(sizeof(thread_future) + value_size, options);
+}
+
+void thread_future_init(thread_future * future)
+{
+    future->value_size = thread_memory_size(future) - sizeof(thread_future);
+
+    thread_future_memory_unlock(future);
+}
+
+void thread_future_set(thread_pool * pool, thread_future * future, const void * value)
+{
+    thread_future_memory_lock(future);
+
+    if (future->ready)
+    {
+	log_error("Future set twice");
+	abort();
+    }
+    
+    memcpy(future_value(future), value, future->value_size);
+    future->ready = true;
+
+    thread_job * continuation = future->continuation;
+    future->continuation = NULL;
+
+    thread_future_memory_broadcast(future);
+    thread_future_memory_unlock(future);
+
+    if (continuation)
+    {
+	thread_job_release(pool, continuation);
+    }
+}
+
+bool thread_future_poll(thread_future * future, void * value)
+{
+    thread_future_memory_lock(future);
+
+    bool retval = future->ready;
+
+    if (retval)
+    {
+	memcpy(value, future_value(future), future->value_size);
+    }
+    
+    thread_future_memory_unlock(future);
+
+    return retval;
+}
+
+void thread_future_wait(thread_pool * pool, thread_future * future, void * value)
+{
+    while (!thread_future_poll(future, value))
+    {
+	if (thread_pool_help(pool))
+	{
+	    continue;
+	}
+
+	thread_future_memory_lock(future);
+
+	while (!future->ready)
+	{
+	    thread_future_memory_wait(future);
+	}
+
+	memcpy(value, future_value(future), future->value_size);
+	
+	thread_future_memory_unlock(future);
+
+	return;
+    }
+}
+
+void * thread_future_get(thread_future * future)
+{
+    assert(future->ready);
+    
+    return future_value(future);
+}
+
+void thread_future_then(thread_pool * pool, thread_future * future, thread_job * job)
+{
+    thread_job_add_dependency(job);
+    thread_job_memory_unlock(job);
+    
+    thread_future_memory_lock(future);
+
+    if (future->ready)
+    {
+	thread_future_memory_unlock(future);
+	thread_job_release(pool, job);
+	return;
+    }
+
+    assert(!future->continuation);
+    
+    future->continuation = job;
+    
+    thread_future_memory_unlock(future);
+}
+
+void thread_future_free(thread_future * future)
+{
+    thread_future_memory_lock(future);
+
+    assert(!future->continuation);
+
+    thread_memory_free(future);
+}
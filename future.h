@@ -0,0 +1,129 @@
+#ifndef FLAT_INCLUDES
+#include <stddef.h>
+#include <stdbool.h>
+#include "memory-pool.h"
+#include "thread-pool.h"
+#endif
+
+typedef struct thread_future thread_future;
+
+thread_memory_pool_declare_types(thread_future, thread_future);
+
+thread_future_memory_pool * thread_future_memory_pool_new(size_t value_size);
+/**<
+   Creates a pool of futures holding values of the given size
+*/
+
+thread_future_memory_pool * thread_future_memory_pool_new_options(size_t value_size, const thread_memory_pool_options * options);
+
+void thread_future_init(thread_future * future);
+/**<
+   Prepares a future freshly allocated from its pool and unlocks it
+*/
+
+void thread_future_set(thread_pool * pool, thread_future * future, const void * value);
+/**<
+   Publishes a value, wakes any waiters and releases the continuation if one is attached. A future may only be set once
+*/
+
+bool thread_future_poll(thread_future * future, void * value);
+/**<
+   Copies the value out and returns true if the future has been set
+*/
+
+void thread_future_wait(thread_pool * pool, thread_future * future, void * value);
+/**<
+   Runs queued jobs until the future is set or there are none left, then blocks until it is set and copies the value out. From a worker this includes the rest of the batch the worker took along with the waiting job, so the producer may be queued after the waiter. Must not be called from a job that is a parent of jobs still queued on the pool
+*/
+
+void * thread_future_get(thread_future * future);
+/**<
+   Returns the stored value of a future that is known to be set, such as from its continuation
+*/
+
+void thread_future_then(thread_pool * pool, thread_future * future, thread_job * job);
+/**<
+   Makes a locked job depend on the future and unlocks it. The job is released when the value is set, or right away if it already has been. A future has at most one continuation, use a job with several parents to fan out
+*/
+
+void thread_future_free(thread_future * future);
+/**<
+   Returns a future to its pool. Nothing may be waiting on it
+*/
+
+#define thread_future_declare(name, type)				\
+									\
+    typedef struct name##_future name##_future;				\
+									\
+    typedef type name##_future_value;					\
+									\
+    thread_memory_pool_declare_types(name##_future, name##_future);	\
+    thread_memory_pool_declare_alloc(name##_future);			\
+    thread_memory_pool_declare_default_alloc(name##_future);		\
+    thread_memory_pool_declare_pool_alloc(name##_future);		\
+									\
+    inline static thread_future * name##_future_generic(name##_future * future) \
+    {									\
+	return (thread_future*)future;					\
+    }									\
+									\
+    inline static name##_future * name##_future_new_from_pool(name##_future_memory_pool * pool) \
+    {									\
+	name##_future * retval = name##_future_memory_calloc_from_pool(pool); \
+	thread_future_init((thread_future*)retval);			\
+	return retval;							\
+    }									\
+									\
+    inline static name##_future * name##_future_new()			\
+    {									\
+	name##_future * retval = name##_future_memory_calloc();		\
+	thread_future_init((thread_future*)retval);			\
+	return retval;							\
+    }									\
+									\
+    inline static void name##_future_set(thread_pool * pool, name##_future * future, name##_future_value value) \
+    {									\
+	thread_future_set(pool, (thread_future*)future, &value);	\
+    }									\
+									\
+    inline static bool name##_future_poll(name##_future * future, name##_future_value * value) \
+    {									\
+	return thread_future_poll((thread_future*)future, value);	\
+    }									\
+									\
+    inline static name##_future_value name##_future_wait(thread_pool * pool, name##_future * future) \
+    {									\
+	name##_future_value value;					\
+	thread_future_wait(pool, (thread_future*)future, &value);	\
+	return value;							\
+    }									\
+									\
+    inline static name##_future_value * name##_future_get(name##_future * future) \
+    {									\
+	return thread_future_get((thread_future*)future);		\
+    }									\
+									\
+    inline static void name##_future_then(thread_pool * pool, name##_future * future, thread_job * job) \
+    {									\
+	thread_future_then(pool, (thread_future*)future, job);		\
+    }									\
+									\
+    inline static void name##_future_free(name##_future * future)	\
+    {									\
+	thread_future_free((thread_future*)future);			\
+    }									\
+
+#define thread_future_define(name)					\
+									\
+    name##_future_memory_pool * name##_future_memory_pool_new()	\
+    {									\
+	return (name##_future_memory_pool*) thread_future_memory_pool_new(sizeof(name##_future_value)); \
+    }									\
+									\
+    name##_future_memory_pool * name##_future_memory_pool_new_options(const thread_memory_pool_options * options) \
+    {									\
+	return (name##_future_memory_pool*) thread_future_memory_pool_new_options(sizeof(name##_future_value), options); \
+    }									\
+									\
+    thread_memory_pool_define_default_alloc(name##_future);		\
+
@@ -5,21 +5,26 @@
 #include <assert.h>
 #include "../window/alloc.h"
 #include <pthread.h>
+#include <time.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include "../log/log.h"
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #define lock(target) pthread_mutex_lock(&(target)->mutex)
 #define unlock(target) pthread_mutex_unlock(&(target)->mutex)
 #define wait(target) pthread_cond_wait(&(target)->cond, &(target)->mutex)
 #define signal(target) pthread_cond_signal(&(target)->cond)
 #define broadcast(target) pthread_cond_broadcast(&(target)->cond)
+#define counted_lock(target, counter) lock_counted(&(target)->mutex, &(counter))
 
 typedef struct memory_pool_segment memory_pool_segment;
 typedef struct {
-    pthread_mutex_t mutex;
+    _Alignas(max_align_t) pthread_mutex_t mutex;
     pthread_cond_t cond;
     bool is_allocated;
     memory_pool_segment * segment;
@@ -32,8 +37,9 @@ window_typedef(memory_pool_header*,memory_pool_header_p);
 
 struct memory_pool_segment {
     size_t count;
+    size_t map_size;
     window_memory_pool_header_p free;
-    uint8_t begin[];
+    _Alignas(max_align_t) uint8_t begin[];
 };
 
 link1_typedef(memory_pool_segment, memory_pool_segment);
@@ -42,48 +48,171 @@ link1_funcdef(memory_pool_segment);
 struct thread_memory_pool {
     pthread_mutex_t mutex;
     size_t alloc_size;
+    size_t item_stride;
     size_t new_segment_count;
+    thread_memory_pool_options options;
     link1_memory_pool_segment * segments;
+    size_t live_count;
+    size_t peak_live_count;
+    size_t reserved_bytes;
+    atomic_size_t pool_lock_contended;
+    atomic_size_t item_lock_contended;
+    atomic_size_t wait_count;
 };
 
+#define MEMORY_POOL_HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+static thread_memory_pool_options default_options;
+
+inline static void lock_counted(pthread_mutex_t * mutex, atomic_size_t * counter)
+{
+    if (pthread_mutex_trylock(mutex))
+    {
+	atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+	pthread_mutex_lock(mutex);
+    }
+}
+
 inline static void * memory_header_end(thread_memory_pool * pool, memory_pool_header * header)
 {
-    return (uint8_t*)header + sizeof(memory_pool_header) + pool->alloc_size;
+    return (uint8_t*)header + pool->item_stride;
 }
 
 inline static void * memory_segment_end(memory_pool_segment * segment, thread_memory_pool * pool)
 {
-    return (memory_pool_header*)(segment->begin + segment->count * (sizeof(memory_pool_header) + pool->alloc_size));
+    return (memory_pool_header*)(segment->begin + segment->count * pool->item_stride);
 }
 
 inline static memory_pool_header * memory_segment_index(memory_pool_segment * segment, thread_memory_pool * pool, size_t index)
 {
-    memory_pool_header * memory_item = (memory_pool_header*)(segment->begin + index * (sizeof(memory_pool_header) + pool->alloc_size));
+    memory_pool_header * memory_item = (memory_pool_header*)(segment->begin + index * pool->item_stride);
     assert(index < segment->count);
     assert((void*)memory_item >= (void*)segment->begin);
     assert(memory_header_end(pool, memory_item) <= memory_segment_end(segment, pool));
     return memory_item;
 }
 
-thread_memory_pool * thread_memory_pool_new(size_t item_size)
+inline static size_t round_up(size_t size, size_t align)
+{
+    return (size + align - 1) / align * align;
+}
+
+void thread_memory_pool_set_default_options(const thread_memory_pool_options * options)
+{
+    default_options = *options;
+}
+
+thread_memory_pool * thread_memory_pool_new_options(size_t item_size, const thread_memory_pool_options * options)
 {
     thread_memory_pool * retval = calloc (1, sizeof(*retval));
 
     pthread_mutex_init(&retval->mutex, NULL);
 
+    retval->options = *options;
     retval->new_segment_count = 1024;
     retval->alloc_size = item_size;
+    retval->item_stride = round_up(sizeof(memory_pool_header) + item_size, _Alignof(max_align_t));
+
+    if (retval->options.max_segment_count && retval->new_segment_count > retval->options.max_segment_count)
+    {
+	retval->new_segment_count = retval->options.max_segment_count;
+    }
     
     return retval;
 }
 
+thread_memory_pool * thread_memory_pool_new(size_t item_size)
+{
+    return thread_memory_pool_new_options(item_size, &default_options);
+}
+
+static void memory_pool_prefault (void * mem, size_t size)
+{
+#ifdef MADV_POPULATE_WRITE
+    if (0 == madvise(mem, size, MADV_POPULATE_WRITE))
+    {
+	return;
+    }
+#endif
+
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    
+    for (size_t i = 0; i < size; i += page_size)
+    {
+	((volatile uint8_t*)mem)[i] = 0;
+    }
+}
+
+static void * memory_pool_map (thread_memory_pool * pool, size_t size, size_t * map_size)
+{
+    void * retval;
+    
+#ifdef MAP_HUGETLB
+    if (pool->options.huge_pages)
+    {
+	*map_size = round_up(size, MEMORY_POOL_HUGE_PAGE_SIZE);
+	retval = mmap(NULL, *map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+	if (retval != MAP_FAILED)
+	{
+	    return retval;
+	}
+    }
+#endif
+
+    *map_size = round_up(size, pool->options.huge_pages ? MEMORY_POOL_HUGE_PAGE_SIZE : (size_t)sysconf(_SC_PAGESIZE));
+    retval = mmap(NULL, *map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (retval == MAP_FAILED)
+    {
+	log_error("Failed to map a memory pool segment of %zu bytes", *map_size);
+	abort();
+    }
+
+#ifdef MADV_HUGEPAGE
+    if (pool->options.huge_pages)
+    {
+	madvise(retval, *map_size, MADV_HUGEPAGE);
+    }
+#endif
+
+    return retval;
+}
+
 static memory_pool_segment * memory_pool_segment_add (thread_memory_pool * pool, size_t count)
 {
-    size_t memory_item_size = sizeof(memory_pool_header) + pool->alloc_size;
+    size_t memory_item_size = pool->item_stride;
+    size_t size = sizeof(link1_memory_pool_segment) + count * memory_item_size;
+    size_t map_size = 0;
     
-    link1_memory_pool_segment * new = calloc(1, sizeof(*new) + count * memory_item_size);
+    link1_memory_pool_segment * new;
+
+    if (pool->options.mmap)
+    {
+	new = memory_pool_map(pool, size, &map_size);
+	size = map_size;
+
+	size_t fit = (map_size - sizeof(*new)) / memory_item_size; // use the slack left by page rounding
+	size_t cap = pool->options.max_segment_count > count ? pool->options.max_segment_count : count;
+
+	count = pool->options.max_segment_count && fit > cap ? cap : fit; // but no more than the cap, a huge page holds thousands of items
+    }
+    else
+    {
+	new = calloc(1, size);
+    }
+
+    if (pool->options.prefault)
+    {
+	memory_pool_prefault(new, size);
+    }
 
     new->child.count = count;
+    new->child.map_size = map_size;
+
+    pool->reserved_bytes += size;
+
+    window_alloc(new->child.free, count);
     
     memory_pool_header * memory_item;
 
@@ -124,6 +253,10 @@ static memory_pool_segment * choose_free_segment (thread_memory_pool * pool)
 	{
 	    assert(i->child.count);
 	    size_t new_segment_count = i->child.count * 2;
+	    if (pool->options.max_segment_count && new_segment_count > pool->options.max_segment_count)
+	    {
+		new_segment_count = pool->options.max_segment_count;
+	    }
 	    if (pool->new_segment_count < new_segment_count)
 	    {
 		pool->new_segment_count = new_segment_count;
@@ -150,13 +283,36 @@ static memory_pool_segment * choose_or_alloc_free_segment (thread_memory_pool *
     }
 }
 
+void thread_memory_pool_reserve(thread_memory_pool * pool, size_t count)
+{
+    assert(pool);
+
+    counted_lock(pool, pool->pool_lock_contended);
+
+    link1_memory_pool_segment * i;
+
+    size_t free_count = 0;
+
+    for_link1(i, *pool->segments)
+    {
+	free_count += range_count(i->child.free.region);
+    }
+
+    if (free_count < count)
+    {
+	memory_pool_segment_add(pool, count - free_count);
+    }
+
+    unlock(pool);
+}
+
 void * thread_memory_pool_calloc_from_pool(thread_memory_pool * pool)
 {
     assert(pool);
     
     memory_pool_header * return_header = NULL;
     
-    lock(pool);
+    counted_lock(pool, pool->pool_lock_contended);
 
     memory_pool_segment * parent = choose_or_alloc_free_segment (pool);
     
@@ -175,6 +331,11 @@ void * thread_memory_pool_calloc_from_pool(thread_memory_pool * pool)
 
     return_header->is_allocated = true;
 
+    if (++pool->live_count > pool->peak_live_count)
+    {
+	pool->peak_live_count = pool->live_count;
+    }
+
     void * retval = return_header + 1;
 
     assert (retval < memory_segment_end(parent, pool));
@@ -190,6 +351,14 @@ void * thread_memory_pool_calloc_from_pool(thread_memory_pool * pool)
     return retval;
 }
 
+size_t thread_memory_size(void * mem)
+{
+    assert(mem);
+    
+    memory_pool_header * header = (memory_pool_header*)mem - 1;
+    return header->pool->alloc_size;
+}
+
 void thread_memory_free(void * mem)
 {
     assert(mem);
@@ -201,7 +370,7 @@ void thread_memory_free(void * mem)
     thread_memory_pool * pool = mem_header->pool;
     memory_pool_segment * segment = mem_header->segment;
 
-    lock(pool);
+    counted_lock(pool, pool->pool_lock_contended);
     
     if (!mem_header->is_allocated)
     {
@@ -211,11 +380,332 @@ void thread_memory_free(void * mem)
 
     *window_push(segment->free) = mem_header;
     mem_header->is_allocated = false;
+    pool->live_count--;
 
     unlock(pool);
     unlock(mem_header);
 }
 
+typedef struct epoch_record epoch_record;
+struct epoch_record {
+    _Atomic uint64_t state; // the epoch seen on entry shifted left, with the low bit set while inside
+    size_t nesting;
+    size_t retired;
+    uint64_t limbo_epoch[3];
+    window_memory_pool_header_p limbo[3];
+    bool in_use;
+    epoch_record * next;
+};
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond; // flushers sleep here until a reader leaves
+    _Atomic uint64_t epoch;
+    epoch_record * records;
+    window_memory_pool_header_p orphans;
+    uint64_t orphan_epoch;
+    atomic_size_t flushers;
+}
+    epoch_domain = { .mutex = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER, .epoch = 1 };
+
+static __thread epoch_record * epoch_self;
+static pthread_key_t epoch_key;
+static pthread_once_t epoch_key_once = PTHREAD_ONCE_INIT;
+
+#define EPOCH_COLLECT_INTERVAL 64
+#define EPOCH_FLUSH_RECHECK 10000000
+
+static void free_headers(window_memory_pool_header_p * headers)
+{
+    memory_pool_header ** i;
+
+    for_range(i, headers->region)
+    {
+	thread_memory_lock(*i + 1);
+	thread_memory_free(*i + 1);
+    }
+
+    headers->region.end = headers->region.begin;
+}
+
+static bool epoch_try_advance()
+{
+    // called with the domain locked
+    
+    uint64_t epoch = atomic_load(&epoch_domain.epoch);
+    epoch_record * record;
+    uint64_t state;
+
+    for (record = epoch_domain.records; record; record = record->next)
+    {
+	if (!record->in_use)
+	{
+	    continue;
+	}
+	
+	state = atomic_load(&record->state);
+
+	if ((state & 1) && (state >> 1) != epoch)
+	{
+	    return false;
+	}
+    }
+
+    atomic_store(&epoch_domain.epoch, epoch + 1);
+
+    return true;
+}
+
+static void epoch_collect(epoch_record * record)
+{
+    lock(&epoch_domain);
+
+    epoch_try_advance();
+
+    uint64_t epoch = atomic_load(&epoch_domain.epoch);
+
+    window_memory_pool_header_p orphans = {0};
+    
+    if (!range_is_empty(epoch_domain.orphans.region) && epoch_domain.orphan_epoch + 2 <= epoch)
+    {
+	orphans = epoch_domain.orphans;
+	epoch_domain.orphans = (window_memory_pool_header_p){0};
+    }
+    
+    unlock(&epoch_domain);
+
+    free_headers(&orphans);
+    window_clear(orphans);
+
+    if (!record)
+    {
+	return;
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+	if (record->limbo_epoch[i] + 2 <= epoch)
+	{
+	    free_headers(&record->limbo[i]);
+	}
+    }
+
+    record->retired = 0;
+}
+
+static bool epoch_has_limbo(epoch_record * record)
+{
+    for (int i = 0; i < 3; i++)
+    {
+	if (!range_is_empty(record->limbo[i].region))
+	{
+	    return true;
+	}
+    }
+
+    return false;
+}
+
+static void epoch_record_release(void * _record)
+{
+    epoch_record * record = _record;
+
+    if (record->nesting)
+    {
+	log_error("Thread exited inside a memory epoch");
+	abort();
+    }
+    
+    epoch_collect(record);
+
+    lock(&epoch_domain);
+
+    memory_pool_header ** i;
+    
+    for (int b = 0; b < 3; b++)
+    {
+	for_range(i, record->limbo[b].region)
+	{
+	    *window_push(epoch_domain.orphans) = *i;
+	}
+
+	if (record->limbo_epoch[b] > epoch_domain.orphan_epoch && !range_is_empty(record->limbo[b].region))
+	{
+	    epoch_domain.orphan_epoch = record->limbo_epoch[b];
+	}
+	
+	window_clear(record->limbo[b]);
+	record->limbo_epoch[b] = 0;
+    }
+
+    record->in_use = false;
+    
+    unlock(&epoch_domain);
+
+    epoch_self = NULL;
+}
+
+static void epoch_key_init()
+{
+    pthread_key_create(&epoch_key, epoch_record_release);
+}
+
+static epoch_record * epoch_record_get()
+{
+    if (epoch_self)
+    {
+	return epoch_self;
+    }
+
+    pthread_once(&epoch_key_once, epoch_key_init);
+
+    lock(&epoch_domain);
+
+    epoch_record * record;
+
+    for (record = epoch_domain.records; record && record->in_use; record = record->next)
+    {
+    }
+
+    if (!record)
+    {
+	record = calloc(1, sizeof(*record));
+	record->next = epoch_domain.records;
+	epoch_domain.records = record;
+    }
+
+    record->in_use = true;
+    
+    unlock(&epoch_domain);
+
+    pthread_setspecific(epoch_key, record);
+    
+    return epoch_self = record;
+}
+
+void thread_memory_epoch_enter()
+{
+    epoch_record * record = epoch_record_get();
+
+    if (record->nesting++)
+    {
+	return;
+    }
+
+    atomic_store_explicit(&record->state, (atomic_load(&epoch_domain.epoch) << 1) | 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst); // the announcement must be visible before any shared pointer is loaded
+}
+
+void thread_memory_epoch_leave()
+{
+    epoch_record * record = epoch_self;
+
+    assert(record && record->nesting);
+
+    if (--record->nesting)
+    {
+	return;
+    }
+
+    atomic_store_explicit(&record->state, 0, memory_order_release);
+
+    if (atomic_load_explicit(&epoch_domain.flushers, memory_order_relaxed))
+    {
+	lock(&epoch_domain);
+	broadcast(&epoch_domain);
+	unlock(&epoch_domain);
+    }
+}
+
+void thread_memory_free_deferred(void * mem)
+{
+    assert(mem);
+    
+    memory_pool_header * mem_header = (memory_pool_header*)mem - 1;
+
+    if (!mem_header->is_allocated)
+    {
+	log_error("Double free");
+	abort();
+    }
+
+    unlock(mem_header); // the reclaiming thread locks it again
+
+    epoch_record * record = epoch_record_get();
+
+    uint64_t epoch = atomic_load(&epoch_domain.epoch);
+    int bucket = epoch % 3;
+
+    if (record->limbo_epoch[bucket] != epoch)
+    {
+	free_headers(&record->limbo[bucket]); // at least three epochs old
+	record->limbo_epoch[bucket] = epoch;
+    }
+
+    *window_push(record->limbo[bucket]) = mem_header;
+
+    if (++record->retired >= EPOCH_COLLECT_INTERVAL)
+    {
+	epoch_collect(record);
+    }
+}
+
+void thread_memory_epoch_collect()
+{
+    if (epoch_self && epoch_has_limbo(epoch_self))
+    {
+	epoch_collect(epoch_self);
+    }
+}
+
+bool thread_memory_epoch_pending()
+{
+    return epoch_self && epoch_has_limbo(epoch_self);
+}
+
+void thread_memory_epoch_flush()
+{
+    epoch_record * record = epoch_self;
+
+    assert(!record || !record->nesting);
+
+    atomic_fetch_add(&epoch_domain.flushers, 1);
+
+    while (true)
+    {
+	epoch_collect(record);
+
+	lock(&epoch_domain);
+	
+	if (range_is_empty(epoch_domain.orphans.region) && (!record || !epoch_has_limbo(record)))
+	{
+	    unlock(&epoch_domain);
+	    break;
+	}
+
+	if (!epoch_try_advance())
+	{
+	    // a reader is inside an older epoch, wait for it to leave, rechecking now and then
+	    // in case its leave raced with the flushers count
+	    struct timespec until;
+	    clock_gettime(CLOCK_REALTIME, &until);
+	    until.tv_nsec += EPOCH_FLUSH_RECHECK;
+	    
+	    if (until.tv_nsec >= 1000000000)
+	    {
+		until.tv_sec++;
+		until.tv_nsec -= 1000000000;
+	    }
+	    
+	    pthread_cond_timedwait(&epoch_domain.cond, &epoch_domain.mutex, &until);
+	}
+	
+	unlock(&epoch_domain);
+    }
+
+    atomic_fetch_sub(&epoch_domain.flushers, 1);
+}
+
 void thread_memory_pool_free(thread_memory_pool * pool)
 {
     assert(pool);
@@ -240,7 +730,7 @@ void thread_memory_pool_free(thread_memory_pool * pool)
 	{
 	    header_ref = *header;
 	    assert(header_ref >= (memory_pool_header*)segment_link->child.begin);
-	    assert(header_ref < (memory_pool_header*)(segment_link->child.begin + segment_link->child.count * (sizeof(memory_pool_header) + pool->alloc_size)));
+	    assert(header_ref < (memory_pool_header*)(segment_link->child.begin + segment_link->child.count * pool->item_stride));
 	    assert(header_ref->is_allocated == false);
 	    pthread_mutex_destroy(&header_ref->mutex);
 	    pthread_cond_destroy(&header_ref->cond);
@@ -248,7 +738,14 @@ void thread_memory_pool_free(thread_memory_pool * pool)
 	
 	window_clear(segment_link->child.free);
 
-	free(segment_link);
+	if (segment_link->child.map_size)
+	{
+	    munmap(segment_link, segment_link->child.map_size);
+	}
+	else
+	{
+	    free(segment_link);
+	}
     }
     
     unlock(pool);
@@ -263,7 +760,7 @@ void thread_memory_lock(void * mem)
     assert(mem);
     
     memory_pool_header * header = (memory_pool_header*)mem - 1;
-    lock(header);
+    counted_lock(header, header->pool->item_lock_contended);
 //    log_debug("Locked %p", mem);
     assert(header->is_allocated);
 }
@@ -283,6 +780,7 @@ void thread_memory_wait(void * mem)
     assert(mem);
     
     memory_pool_header * header = (memory_pool_header*)mem - 1;
+    atomic_fetch_add_explicit(&header->pool->wait_count, 1, memory_order_relaxed);
     wait(header);
     assert(header->is_allocated);
 }
@@ -310,3 +808,52 @@ void * thread_memory_pool_calloc_from_peer(void * mem)
     memory_pool_header * header = (memory_pool_header*)mem - 1;
     return thread_memory_pool_calloc_from_pool(header->pool);
 }
+
+void thread_memory_pool_get_stats(thread_memory_pool * pool, thread_memory_pool_stats * stats)
+{
+    assert(pool);
+    assert(stats);
+
+    *stats = (thread_memory_pool_stats){0};
+    
+    lock(pool);
+
+    link1_memory_pool_segment * i;
+
+    for_link1(i, *pool->segments)
+    {
+	if (!stats->segment_count || i->child.count < stats->smallest_segment)
+	{
+	    stats->smallest_segment = i->child.count;
+	}
+
+	if (i->child.count > stats->largest_segment)
+	{
+	    stats->largest_segment = i->child.count;
+	}
+	
+	stats->segment_count++;
+	stats->free_count += range_count(i->child.free.region);
+    }
+
+    stats->item_size = pool->alloc_size;
+    stats->new_segment_count = pool->new_segment_count;
+    stats->live_count = pool->live_count;
+    stats->peak_live_count = pool->peak_live_count;
+    stats->reserved_bytes = pool->reserved_bytes;
+    stats->used_bytes = pool->live_count * pool->item_stride;
+    
+    unlock(pool);
+
+    stats->pool_lock_contended = atomic_load_explicit(&pool->pool_lock_contended, memory_order_relaxed);
+    stats->item_lock_contended = atomic_load_explicit(&pool->item_lock_contended, memory_order_relaxed);
+    stats->wait_count = atomic_load_explicit(&pool->wait_count, memory_order_relaxed);
+}
+
+void thread_memory_pool_get_stats_from_peer(void * mem, thread_memory_pool_stats * stats)
+{
+    assert(mem);
+    
+    memory_pool_header * header = (memory_pool_header*)mem - 1;
+    thread_memory_pool_get_stats(header->pool, stats);
+}
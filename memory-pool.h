@@ -1,13 +1,64 @@
 #ifndef FLAT_INCLUDES
 #include <stddef.h>
+#include <stdbool.h>
 #define FLAT_INCLUDES
 #endif
 
 typedef struct thread_memory_pool thread_memory_pool;
 
+typedef struct {
+    bool mmap; /**< Back segments with anonymous mmap instead of calloc */
+    bool huge_pages; /**< Ask for huge pages on mmap'd segments, falling back to transparent huge pages and then normal pages */
+    bool prefault; /**< Fault in every page of a segment when it is added rather than on first touch */
+    size_t max_segment_count; /**< Upper bound on the number of items in a new segment, or 0 to keep doubling. Mapped segments fill the slack of their last page up to this bound */
+}
+    thread_memory_pool_options;
+
 thread_memory_pool * thread_memory_pool_new(size_t item_size);
 /**<
-   Creates a new memory pool
+   Creates a new memory pool using the default options
+*/
+
+thread_memory_pool * thread_memory_pool_new_options(size_t item_size, const thread_memory_pool_options * options);
+/**<
+   Creates a new memory pool with the given options
+*/
+
+void thread_memory_pool_set_default_options(const thread_memory_pool_options * options);
+/**<
+   Sets the options used by thread_memory_pool_new for pools created afterwards
+*/
+
+void thread_memory_pool_reserve(thread_memory_pool * pool, size_t count);
+/**<
+   Adds a segment if needed so that at least count items can be allocated without growing the pool
+*/
+
+typedef struct {
+    size_t item_size; /**< Size of each item, not counting its header */
+    size_t segment_count; /**< Number of segments in the pool */
+    size_t smallest_segment; /**< Item count of the smallest segment */
+    size_t largest_segment; /**< Item count of the largest segment */
+    size_t new_segment_count; /**< Item count the next segment will be created with */
+    size_t live_count; /**< Items currently allocated */
+    size_t free_count; /**< Items available without adding a segment */
+    size_t peak_live_count; /**< Highest live_count seen over the life of the pool */
+    size_t reserved_bytes; /**< Bytes held by all segments */
+    size_t used_bytes; /**< Bytes held by live items and their headers */
+    size_t pool_lock_contended; /**< Times the pool mutex was already held when an allocation or free tried to take it */
+    size_t item_lock_contended; /**< Times an item mutex was already held when thread_memory_lock tried to take it */
+    size_t wait_count; /**< Calls to thread_memory_wait */
+}
+    thread_memory_pool_stats;
+
+void thread_memory_pool_get_stats(thread_memory_pool * pool, thread_memory_pool_stats * stats);
+/**<
+   Fills stats with a snapshot of the pool's size and contention counters
+*/
+
+void thread_memory_pool_get_stats_from_peer(void * mem, thread_memory_pool_stats * stats);
+/**<
+   Fills stats for the pool that the given memory was allocated from
 */
 
 void * thread_memory_pool_calloc_from_pool(thread_memory_pool * pool);
@@ -20,11 +71,46 @@ void * thread_memory_pool_calloc_from_peer(void * mem);
    Allocates pre-zero'd and locked memory of the given type
 */
 
+size_t thread_memory_size(void * mem);
+/**<
+   Returns the item size of the pool the memory was allocated from
+*/
+
 void thread_memory_free(void * mem);
 /**<
    Frees locked memory
 */
 
+void thread_memory_free_deferred(void * mem);
+/**<
+   Frees locked memory once no thread can still be inside an epoch that began before the call. Readers that load shared pointers without locking bracket their reads with thread_memory_epoch_enter and thread_memory_epoch_leave, and the memory must already be unreachable for new readers
+*/
+
+void thread_memory_epoch_enter();
+/**<
+   Marks the calling thread as a reader of memory that may be freed with thread_memory_free_deferred. Nests, and is cheap enough to bracket every job; pool workers already do so around each job they run
+*/
+
+void thread_memory_epoch_leave();
+/**<
+   Ends the calling thread's outermost epoch, after which it holds no pointers to deferred memory
+*/
+
+void thread_memory_epoch_collect();
+/**<
+   Frees whatever memory the calling thread deferred that no reader can still hold, without waiting
+*/
+
+bool thread_memory_epoch_pending();
+/**<
+   Returns true if the calling thread deferred memory that has not been freed yet
+*/
+
+void thread_memory_epoch_flush();
+/**<
+   Sleeps until readers have left the epochs they were in, then frees all memory deferred by the calling thread or by threads that have exited. Called outside any epoch, before freeing a pool that memory was deferred from
+*/
+
 void thread_memory_pool_free(thread_memory_pool * pool);
 /**<
    Frees a pool in which all allocated memory has already been freed using thread_memory_free
@@ -69,6 +155,16 @@ void thread_memory_broadcast(void * mem);
 	thread_memory_pool_free((thread_memory_pool*)pool);		\
     }									\
 									\
+    inline static void name##_memory_pool_reserve(name##_memory_pool * pool, size_t count) \
+    {									\
+	thread_memory_pool_reserve((thread_memory_pool*)pool, count);	\
+    }									\
+									\
+    inline static void name##_memory_pool_get_stats(name##_memory_pool * pool, thread_memory_pool_stats * stats) \
+    {									\
+	thread_memory_pool_get_stats((thread_memory_pool*)pool, stats); \
+    }									\
+									\
     inline static name##_memory * name##_memory_calloc_from_pool(name##_memory_pool * pool) \
     {									\
 	return thread_memory_pool_calloc_from_pool((thread_memory_pool*)pool);	\
@@ -89,10 +185,14 @@ void thread_memory_broadcast(void * mem);
     void name##_memory_calloc_init();			\
 						\
     name##_memory * name##_memory_calloc();	\
+						\
+    void name##_memory_get_default_stats(thread_memory_pool_stats * stats); \
 
 #define thread_memory_pool_declare_pool_alloc(name)			\
 									\
     name##_memory_pool * name##_memory_pool_new();			\
+									\
+    name##_memory_pool * name##_memory_pool_new_options(const thread_memory_pool_options * options); \
 
 #define thread_memory_pool_declare_concurrency(name)			\
 									\
@@ -126,6 +226,11 @@ void thread_memory_broadcast(void * mem);
     name##_memory_pool * name##_memory_pool_new()			\
     {									\
 	return (name##_memory_pool*)thread_memory_pool_new(sizeof(name##_memory)); \
+    }									\
+									\
+    name##_memory_pool * name##_memory_pool_new_options(const thread_memory_pool_options * options) \
+    {									\
+	return (name##_memory_pool*)thread_memory_pool_new_options(sizeof(name##_memory), options); \
     }									\
     
 #define thread_memory_pool_declare(name,type)		\
@@ -141,6 +246,11 @@ void thread_memory_broadcast(void * mem);
     inline static name##_memory_pool * name##_memory_pool_new()	\
     {								\
 	return (name##_memory_pool*) from##_memory_pool_new();	\
+    }								\
+								\
+    inline static name##_memory_pool * name##_memory_pool_new_options(const thread_memory_pool_options * options) \
+    {								\
+	return (name##_memory_pool*) from##_memory_pool_new_options(options); \
     }								\
 
 #define thread_memory_pool_define_default_alloc(name)				\
@@ -163,4 +273,9 @@ void thread_memory_broadcast(void * mem);
     {									\
 	return name##_memory_calloc_from_pool(_##name##_memory_pool_default); \
     }									\
+									\
+    void name##_memory_get_default_stats(thread_memory_pool_stats * stats) \
+    {									\
+	name##_memory_pool_get_stats(_##name##_memory_pool_default, stats); \
+    }									\
 
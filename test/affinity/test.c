@@ -0,0 +1,54 @@
+#include "../../thread-pool.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include "../total.h"
+#include "../../../log/log.h"
+
+#define WIDTH 40
+
+thread_job_declare(chain);
+thread_job_define_arg(chain, struct { atomic_int * count; total_job * total; size_t worker; int remaining; });
+
+thread_job_define_function(chain)
+{
+    size_t worker = thread_pool_worker_index(pool);
+    
+    assert(worker != SIZE_MAX);
+    assert(arg->worker == SIZE_MAX || arg->worker == worker);
+    atomic_fetch_add(arg->count, 1);
+
+    if (!arg->remaining)
+    {
+	return;
+    }
+    
+    chain_job * next = chain_job_memory_calloc_from_peer(self);
+    *chain_job_init(next) = (chain_job_arg){ arg->count, arg->total, worker, arg->remaining - 1 };
+    thread_job_set_affinity(chain_job_generic(next), THREAD_AFFINITY_SAME_WORKER, 0);
+    total_add_job(pool, arg->total, chain_job_generic(next));
+}
+
+int main()
+{
+    total_init();
+    chain_job_memory_calloc_init();
+
+    atomic_int count = 0;
+
+    total_job * total = total_new(&count, 3 * WIDTH);
+
+    chain_job * chain = chain_job_memory_calloc();
+    *chain_job_init(chain) = (chain_job_arg){ &count, total, SIZE_MAX, 3 * WIDTH - 1 };
+    total_job_add_child(total, chain_job_generic(chain));
+
+    total_job_memory_unlock(total);
+
+    // a single chain keeps at most one link queued on its worker, which the steal rule leaves alone, so every link stays put
+    thread_pool_host(4, chain_job_generic(chain));
+
+    assert(count == 3 * WIDTH);
+
+    return 0;
+}
@@ -0,0 +1,41 @@
+#include "../../thread-pool.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include "../total.h"
+#include "../../../log/log.h"
+
+#define WIDTH 40
+
+thread_job_declare(spawner);
+thread_job_define_arg(spawner, struct { atomic_int * count; total_job * total; size_t capacity; });
+
+thread_job_define_function(spawner)
+{
+    for (int i = 0; i < WIDTH * 25; i++)
+    {
+	total_add_tally(pool, arg->total, arg->count);
+	assert(thread_pool_job_count(pool) <= arg->capacity);
+    }
+}
+
+int main()
+{
+    total_init();
+    spawner_job_memory_calloc_init();
+
+    atomic_int count = 0;
+
+    total_job * total = total_new(&count, WIDTH * 25);
+
+    spawner_job * spawner = spawner_job_memory_calloc();
+    *spawner_job_init(spawner) = (spawner_job_arg){ &count, total, 4 };
+    total_job_add_child(total, spawner_job_generic(spawner));
+    total_job_memory_unlock(total);
+
+    thread_pool_host_options(&(thread_pool_options){ .worker_count = 4, .queue_capacity = 4 }, spawner_job_generic(spawner));
+
+    assert(count == WIDTH * 25);
+
+    return 0;
+}
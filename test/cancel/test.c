@@ -0,0 +1,55 @@
+#include "../../thread-pool.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include "../../../log/log.h"
+
+thread_job_declare(victim);
+thread_job_declare(survivor);
+thread_job_define_arg(victim, struct { atomic_int * count; });
+thread_job_define_arg(survivor, struct { atomic_int * count; });
+
+thread_job_define_function(victim)
+{
+    atomic_fetch_add(arg->count, 1);
+}
+
+thread_job_define_function(survivor)
+{
+    assert(atomic_load(arg->count) == 0);
+    thread_pool_quit(pool);
+}
+
+int main()
+{
+    victim_job_memory_calloc_init();
+    survivor_job_memory_calloc_init();
+
+    atomic_int count = 0;
+    
+    thread_cancel_token * token = thread_cancel_token_new();
+
+    survivor_job * survivor = survivor_job_memory_calloc();
+    *survivor_job_init(survivor) = (survivor_job_arg){ &count };
+
+    victim_job * middle = victim_job_memory_calloc();
+    *victim_job_init(middle) = (victim_job_arg){ &count };
+    thread_job_set_cancel_token(victim_job_generic(middle), token);
+    survivor_job_add_child(survivor, victim_job_generic(middle));
+
+    victim_job * leaf = victim_job_memory_calloc();
+    *victim_job_init(leaf) = (victim_job_arg){ &count };
+    victim_job_add_child(middle, victim_job_generic(leaf));
+
+    victim_job_memory_unlock(middle);
+    survivor_job_memory_unlock(survivor);
+
+    thread_cancel_token_cancel(token);
+    thread_cancel_token_release(token);
+
+    thread_pool_host(2, victim_job_generic(leaf));
+
+    assert(count == 0);
+
+    return 0;
+}
@@ -1,12 +1,14 @@
 #include "../../thread-pool.h"
 #include <stdio.h>
 #include <time.h>
+#include "../../benchmark.h"
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
 #include <pthread.h>
 #include "../../../log/log.h"
 #include <math.h>
+#include <stdatomic.h>
 
 typedef struct {
     int count;
@@ -75,45 +77,111 @@ thread_job_define_function(leaf)
 thread_job_define_function(root)
 {
     printf("root %d\n", arg->result->count);
+    assert(arg->result->count == 75973);
     pthread_mutex_destroy(&arg->result->mutex);
     free(arg->result);
     thread_pool_quit(pool);
 }
 
-int main()
+typedef struct {
+    int count;
+    atomic_int * result;
+}
+    node_arg;
+
+void node_task(thread_pool * pool, void * _arg)
 {
-    log_debug("start");
+    node_arg * arg = _arg;
+    
+    atomic_fetch_add_explicit(arg->result, 1, memory_order_relaxed);
 
-    root_job_memory_calloc_init();
-    leaf_job_memory_calloc_init();
+    float f = 3.14159;
     
-    root_job * root_job = root_job_memory_calloc();
+    for(int i = 0; i < 5; i++)
+    {
+	sqrt(f * i);
+    }
 
-    log_debug("allocated root job %p", root_job);
+    if (!arg->count)
+    {
+	return;
+    }
+
+    thread_task_scope scope = {0};
+    thread_task tasks[2 * arg->count];
+    node_arg args[2 * arg->count];
+
+    for (int i = 0; i < 2 * arg->count; i++)
+    {
+	args[i] = (node_arg){ arg->count - 1, arg->result };
+	thread_task_spawn(pool, &scope, &tasks[i], node_task, &args[i]);
+    }
+
+    thread_task_sync(pool, &scope);
+}
+
+thread_job_declare(spawn);
+thread_job_define_arg(spawn, struct { int count; });
+
+thread_job_define_function(spawn)
+{
+    atomic_int result = 0;
     
+    node_task(pool, &(node_arg){ arg->count, &result });
+
+    printf("spawn %d\n", atomic_load(&result));
+    assert(result == 75973);
+    thread_pool_quit(pool);
+}
+
+void count_leaves(thread_schedule schedule)
+{
+    root_job * root_job = root_job_memory_calloc();
+
     root_result * result = root_result_new();
-    
-    log_debug("allocated result");
 
     *root_job_init(root_job) = (root_job_arg){ result };
 
-    log_debug("initialized root");
-
     root_job_memory_unlock(root_job);
 
-    log_debug("unlocked root");
-    
     leaf_job * leaf_job = leaf_job_memory_calloc();
 
-    log_debug("allocated leaf job");
-
     *leaf_job_init(leaf_job) = (leaf_job_arg){ 6, result };
 
     root_job_add_child(root_job, leaf_job_generic(leaf_job));
 
-    log_debug("initialized leaf job");
+    thread_pool_host_options(&(thread_pool_options){ .worker_count = 2, .schedule = schedule }, leaf_job_generic(leaf_job));
+}
 
-    thread_pool_host(2, leaf_job_generic(leaf_job));
+int main()
+{
+    log_debug("start");
+
+    root_job_memory_calloc_init();
+    leaf_job_memory_calloc_init();
+    
+    benchmark_start();
+    count_leaves(THREAD_SCHEDULE_LIFO);
+    benchmark_time("lifo");
+
+    benchmark_start();
+    count_leaves(THREAD_SCHEDULE_FIFO);
+    benchmark_time("fifo");
+
+    benchmark_start();
+    count_leaves(THREAD_SCHEDULE_RANDOM);
+    benchmark_time("random");
+
+    benchmark_start();
+    count_leaves(THREAD_SCHEDULE_ADAPTIVE);
+    benchmark_time("adaptive");
+
+    spawn_job_memory_calloc_init();
+
+    spawn_job * spawn_job = spawn_job_memory_calloc();
+    *spawn_job_init(spawn_job) = (spawn_job_arg){ 6 };
+    
+    thread_pool_host(4, spawn_job_generic(spawn_job));
     
     return 0;
 }
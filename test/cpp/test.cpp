@@ -0,0 +1,137 @@
+#include "../../thread-pool.hpp"
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <string>
+
+struct tracked
+{
+    std::atomic<int> * destroyed;
+
+    explicit tracked(std::atomic<int> * destroyed) : destroyed(destroyed) {}
+    tracked(tracked && other) noexcept : destroyed(other.destroyed) { other.destroyed = nullptr; }
+    ~tracked() { if (destroyed) (*destroyed)++; }
+}; /**< Counts the destruction of the one copy that was not moved from */
+
+long fib(thread::pool_ref pool, int n)
+{
+    if (n < 2)
+    {
+	return n;
+    }
+    
+    long a, b;
+    thread::task first([&](thread::pool_ref pool) { a = fib(pool, n - 1); });
+
+    {
+	thread::task_scope scope(pool);
+	scope.spawn(first);
+	b = fib(pool, n - 2);
+    }
+    
+    return a + b;
+}
+
+void test_lifetimes()
+{
+    std::atomic<int> destroyed{0};
+    std::atomic<int> runs{0};
+    bool cancelled_ran = false;
+    
+    thread_job * done = thread::make_job([&](thread::pool_ref pool) {
+	assert(runs == 1 + 2 + 3 + 40);
+	pool.quit();
+    });
+
+    thread_job * plain = thread::make_job([&runs, t = tracked(&destroyed), s = std::string(40, 'p')] {
+	assert(s.size() == 40);
+	runs++;
+    });
+    
+    thread_cancel_token * token = thread_cancel_token_new();
+    thread_job * cancelled = thread::make_job([&cancelled_ran, t = tracked(&destroyed)] { cancelled_ran = true; });
+    thread_job_set_cancel_token(cancelled, token);
+    thread_cancel_token_cancel(token);
+    thread_cancel_token_release(token);
+
+    thread_job * resumed = thread::make_job([&runs, phase = 0, t = tracked(&destroyed), s = std::string(40, 'r')](const thread::job_context & context) mutable {
+	assert(s.size() == 40); // still alive on the second run
+	runs++;
+	
+	if (phase++)
+	{
+	    return;
+	}
+
+	for (int i = 0; i < 40; i++)
+	{
+	    thread_job * child = thread::make_job([&runs] { runs++; });
+	    thread_job_add_child(context.self, child);
+	    context.pool.add(child);
+	}
+
+	thread_job_suspend(context.self);
+    });
+
+    token = thread_cancel_token_new();
+    thread_job * periodic = thread::make_job([&runs, token, count = 0, t = tracked(&destroyed), s = std::string(40, 'e')]() mutable {
+	assert(s.size() == 40);
+	runs++;
+
+	if (++count == 3)
+	{
+	    thread_cancel_token_cancel(token); // the next tick is skipped and ends the job
+	}
+    });
+    thread_job_set_cancel_token(periodic, token);
+    thread_cancel_token_release(token);
+
+    thread_job * jobs[] = { plain, cancelled, resumed, periodic };
+
+    for (thread_job * job : jobs)
+    {
+	thread_job_add_child(done, job);
+	thread_memory_unlock(job); // the first job locks them again on a worker before queueing them
+    }
+    
+    thread_memory_unlock(done);
+
+    thread::host(4, [&](thread::pool_ref pool) {
+	for (thread_job * job : jobs)
+	{
+	    thread_memory_lock(job);
+	}
+	
+	pool.add(plain);
+	pool.add(cancelled);
+	pool.add(resumed);
+	thread_pool_add_job_every(pool.get(), periodic, 1000000);
+    });
+
+    assert(!cancelled_ran);
+    assert(destroyed == 4); // once each, whether the job ran once, never, twice or periodically
+}
+
+int main()
+{
+    test_lifetimes();
+
+    long result = 0;
+    
+    thread::host(4, [&result](thread::pool_ref pool) {
+	result = fib(pool, 20);
+	pool.quit();
+    });
+
+    printf("fib %ld\n", result);
+    assert(result == 6765);
+
+    thread::memory_pool<std::string> strings;
+    std::string * pooled = strings.make(40, 's');
+    assert(pooled->size() == 40);
+    assert(strings.stats().live_count == 1);
+    thread::memory_pool<std::string>::destroy(pooled);
+    assert(strings.stats().live_count == 0);
+
+    return 0;
+}
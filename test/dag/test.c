@@ -0,0 +1,69 @@
+#include "../../thread-pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include "../../../log/log.h"
+
+#define WIDTH 40
+
+thread_job_declare(source);
+thread_job_declare(middle);
+thread_job_declare(sink);
+thread_job_define_arg(source, struct { atomic_int * count; });
+thread_job_define_arg(middle, struct { atomic_int * count; });
+thread_job_define_arg(sink, struct { atomic_int * count; });
+
+thread_job_define_function(source)
+{
+    assert(parent);
+    assert(atomic_load(arg->count) == 0);
+    atomic_fetch_add(arg->count, 1);
+}
+
+thread_job_define_function(middle)
+{
+    assert(parent);
+    assert(atomic_load(arg->count) >= 1);
+    atomic_fetch_add(arg->count, 1);
+}
+
+thread_job_define_function(sink)
+{
+    assert(!parent);
+    printf("sink %d\n", atomic_load(arg->count));
+    assert(atomic_load(arg->count) == WIDTH + 1);
+    thread_pool_quit(pool);
+}
+
+int main()
+{
+    source_job_memory_calloc_init();
+    middle_job_memory_calloc_init();
+    sink_job_memory_calloc_init();
+
+    atomic_int count = 0;
+
+    sink_job * sink = sink_job_memory_calloc();
+    *sink_job_init(sink) = (sink_job_arg){ &count };
+
+    source_job * source = source_job_memory_calloc();
+    *source_job_init(source) = (source_job_arg){ &count };
+
+    for (int i = 0; i < WIDTH; i++)
+    {
+	middle_job * middle = middle_job_memory_calloc();
+	*middle_job_init(middle) = (middle_job_arg){ &count };
+	middle_job_add_child(middle, source_job_generic(source));
+	sink_job_add_child(sink, middle_job_generic(middle));
+	middle_job_memory_unlock(middle);
+    }
+
+    sink_job_memory_unlock(sink);
+
+    thread_pool_host(4, source_job_generic(source));
+
+    assert(count == WIDTH + 1);
+    
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include "../../thread-pool.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "../../../log/log.h"
+
+#define WIDTH 40
+
+thread_job_declare(hop);
+thread_job_declare(settle);
+thread_job_declare(burst);
+thread_job_define_arg(settle, struct { atomic_int * count; atomic_size_t * peak; });
+thread_job_define_arg(hop, struct { atomic_int * count; atomic_size_t * peak; settle_job * settle; int hops; });
+thread_job_define_arg(burst, struct { atomic_int * count; atomic_size_t * peak; settle_job * settle; });
+
+thread_job_define_function(hop)
+{
+    size_t workers = thread_pool_worker_count(pool);
+    size_t peak = atomic_load(arg->peak);
+
+    while (workers > peak && !atomic_compare_exchange_weak(arg->peak, &peak, workers))
+    {
+    }
+    
+    atomic_fetch_add(arg->count, 1);
+
+    if (!arg->hops)
+    {
+	return;
+    }
+
+    hop_job * next = hop_job_memory_calloc_from_peer(self);
+    *hop_job_init(next) = (hop_job_arg){ arg->count, arg->peak, arg->settle, arg->hops - 1 };
+    settle_job_memory_lock(arg->settle);
+    settle_job_add_child(arg->settle, hop_job_generic(next));
+    settle_job_memory_unlock(arg->settle);
+    thread_job_set_affinity(hop_job_generic(next), THREAD_AFFINITY_SAME_WORKER, 0); // a worker holding these does not retire until they ran
+    bool added = thread_pool_add_hop_job(pool, next);
+    assert(added);
+}
+
+thread_job_define_function(settle)
+{
+    assert(thread_pool_worker_index(pool) == 0);
+    assert(atomic_load(arg->count) == WIDTH * 50);
+    assert(atomic_load(arg->peak) > 1); // the deep queue grew the pool
+
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    do
+    {
+	nanosleep(&(struct timespec){ .tv_nsec = 1000000 }, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+    }
+    while (thread_pool_worker_count(pool) > 1 && now.tv_sec - start.tv_sec < 10);
+
+    assert(thread_pool_worker_count(pool) == 1); // with nothing queued, every worker but the host retired
+    thread_pool_quit(pool);
+}
+
+thread_job_define_function(burst)
+{
+    for (int i = 0; i < WIDTH * 25; i++)
+    {
+	hop_job * hop = hop_job_memory_calloc();
+	*hop_job_init(hop) = (hop_job_arg){ arg->count, arg->peak, arg->settle, 1 };
+	settle_job_memory_lock(arg->settle);
+	settle_job_add_child(arg->settle, hop_job_generic(hop));
+	settle_job_memory_unlock(arg->settle);
+	bool added = thread_pool_add_hop_job(pool, hop);
+	assert(added);
+    }
+}
+
+int main()
+{
+    hop_job_memory_calloc_init();
+    settle_job_memory_calloc_init();
+    burst_job_memory_calloc_init();
+
+    atomic_int count = 0;
+    atomic_size_t peak = 0;
+
+    settle_job * settle = settle_job_memory_calloc();
+    *settle_job_init(settle) = (settle_job_arg){ &count, &peak };
+    thread_job_set_affinity(settle_job_generic(settle), THREAD_AFFINITY_WORKER, 0); // the host never retires, so it can watch the others do so
+
+    burst_job * burst = burst_job_memory_calloc();
+    *burst_job_init(burst) = (burst_job_arg){ &count, &peak, settle };
+    settle_job_add_child(settle, burst_job_generic(burst));
+    settle_job_memory_unlock(settle);
+
+    thread_pool_host_options(&(thread_pool_options){ .worker_count = 1, .max_workers = 4, .idle_timeout = 1000000, .grow_queue_depth = 2 }, burst_job_generic(burst));
+
+    assert(count == WIDTH * 50);
+
+    return 0;
+}
@@ -0,0 +1,142 @@
+#include "../../thread-pool.h"
+#include "../../future.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <assert.h>
+#include "../../../log/log.h"
+
+#define WIDTH 64
+
+thread_future_declare(number, long);
+thread_future_define(number);
+
+thread_job_declare(produce);
+thread_job_declare(reduce);
+thread_job_declare(root);
+thread_job_declare(consume);
+thread_job_declare(order);
+thread_job_define_arg(produce, struct { long value; number_future * result; });
+thread_job_define_arg(reduce, struct { number_future ** inputs; number_future * result; });
+thread_job_define_arg(root, struct { int unused; });
+thread_job_define_arg(consume, struct { long value; number_future * input; atomic_int * count; });
+thread_job_define_arg(order, struct { atomic_int * count; });
+
+thread_job_define_function(produce)
+{
+    number_future_set(pool, arg->result, arg->value * arg->value);
+}
+
+thread_job_define_function(reduce)
+{
+    long sum = 0;
+    
+    for (int i = 0; i < WIDTH; i++)
+    {
+	sum += *number_future_get(arg->inputs[i]);
+	number_future_free(arg->inputs[i]);
+    }
+
+    number_future_set(pool, arg->result, sum);
+}
+
+thread_job_define_function(root)
+{
+    number_future * inputs[WIDTH];
+    number_future * result = number_future_new();
+
+    reduce_job * reduce = reduce_job_memory_calloc();
+    *reduce_job_init(reduce) = (reduce_job_arg){ inputs, result };
+    
+    for (int i = 0; i < WIDTH; i++)
+    {
+	inputs[i] = number_future_new();
+	number_future_then(pool, inputs[i], reduce_job_generic(reduce));
+	reduce_job_memory_lock(reduce);
+    }
+
+    reduce_job_memory_unlock(reduce);
+
+    for (int i = 0; i < WIDTH; i++)
+    {
+	produce_job * produce = produce_job_memory_calloc();
+	*produce_job_init(produce) = (produce_job_arg){ i, inputs[i] };
+	thread_pool_add_produce_job(pool, produce);
+    }
+
+    long sum = number_future_wait(pool, result);
+    
+    number_future_free(result);
+    
+    printf("sum %ld\n", sum);
+    assert(sum == (long)(WIDTH - 1) * WIDTH * (2 * WIDTH - 1) / 6);
+    
+    thread_pool_quit(pool);
+}
+
+thread_job_define_function(consume)
+{
+    long value = number_future_wait(pool, arg->input);
+
+    assert(value == arg->value * arg->value);
+    number_future_free(arg->input);
+
+    if (atomic_fetch_add(arg->count, 1) == WIDTH - 1)
+    {
+	thread_pool_quit(pool);
+    }
+}
+
+thread_job_define_function(order)
+{
+    number_future * inputs[WIDTH];
+
+    for (int i = 0; i < WIDTH; i++)
+    {
+	inputs[i] = number_future_new();
+	consume_job * consume = consume_job_memory_calloc();
+	*consume_job_init(consume) = (consume_job_arg){ i, inputs[i], arg->count };
+	thread_pool_add_consume_job(pool, consume);
+    }
+
+    for (int i = 0; i < WIDTH; i++)
+    {
+	produce_job * produce = produce_job_memory_calloc();
+	*produce_job_init(produce) = (produce_job_arg){ i, inputs[i] };
+	thread_pool_add_produce_job(pool, produce);
+    }
+}
+
+void test_order(size_t workers)
+{
+    atomic_int count = 0;
+    
+    order_job * order = order_job_memory_calloc();
+    *order_job_init(order) = (order_job_arg){ &count };
+
+    thread_pool_host(workers, order_job_generic(order)); // each consumer is queued before its producer, likely in the same batch
+
+    assert(count == WIDTH);
+}
+
+int main()
+{
+    number_future_memory_calloc_init();
+    produce_job_memory_calloc_init();
+    reduce_job_memory_calloc_init();
+    root_job_memory_calloc_init();
+
+    root_job * root = root_job_memory_calloc();
+    *root_job_init(root) = (root_job_arg){0};
+    
+    thread_pool_host(4, root_job_generic(root));
+
+    consume_job_memory_calloc_init();
+    order_job_memory_calloc_init();
+    
+    test_order(1);
+    test_order(2);
+    test_order(4);
+
+    return 0;
+}
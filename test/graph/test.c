@@ -0,0 +1,86 @@
+#include "../../thread-pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include "../../../log/log.h"
+
+#define RUNS 5
+
+thread_job_declare(node);
+thread_job_declare(launch);
+thread_job_define_arg(node, struct { atomic_int * count; int run; });
+thread_job_define_arg(launch, struct { thread_job_graph * graph; node_job_arg ** args; int run; });
+
+thread_job_define_function(node)
+{
+    atomic_fetch_add(arg->count, arg->run);
+}
+
+thread_job_define_function(launch)
+{
+    if (arg->run)
+    {
+	assert(atomic_load(arg->args[0]->count) == 4 * arg->run * (arg->run + 1) / 2);
+    }
+
+    if (arg->run == RUNS)
+    {
+	thread_pool_quit(pool);
+	return;
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+	arg->args[i]->run = arg->run + 1;
+    }
+
+    launch_job * next = launch_job_memory_calloc_from_peer(self);
+    *launch_job_init(next) = (launch_job_arg){ arg->graph, arg->args, arg->run + 1 };
+    
+    thread_job_graph_launch(pool, arg->graph, launch_job_generic(next));
+}
+
+int main()
+{
+    node_job_memory_calloc_init();
+    launch_job_memory_calloc_init();
+
+    atomic_int count = 0;
+
+    thread_job_graph * graph = thread_job_graph_new();
+
+    node_job * nodes[4];
+    node_job_arg * args[4];
+
+    for (int i = 0; i < 4; i++)
+    {
+	nodes[i] = node_job_memory_calloc();
+	args[i] = node_job_init(nodes[i]);
+	*args[i] = (node_job_arg){ &count, 0 };
+    }
+
+    node_job_add_child(nodes[1], node_job_generic(nodes[0]));
+    node_job_add_child(nodes[2], node_job_generic(nodes[0]));
+    node_job_add_child(nodes[3], node_job_generic(nodes[1]));
+    node_job_add_child(nodes[3], node_job_generic(nodes[2]));
+
+    for (int i = 0; i < 4; i++)
+    {
+	thread_job_graph_add(graph, node_job_generic(nodes[i]));
+    }
+
+    thread_job_graph_seal(graph);
+
+    launch_job * launch = launch_job_memory_calloc();
+    *launch_job_init(launch) = (launch_job_arg){ graph, args, 0 };
+    
+    thread_pool_host(4, launch_job_generic(launch));
+
+    printf("graph %d\n", atomic_load(&count));
+    assert(count == 4 * RUNS * (RUNS + 1) / 2); // each of the four nodes adds the run number, every run
+    
+    thread_job_graph_free(graph);
+
+    return 0;
+}
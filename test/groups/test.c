@@ -0,0 +1,70 @@
+#include "../../thread-pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include "../total.h"
+#include "../../../log/log.h"
+
+#define WIDTH 40
+
+thread_job_declare(share);
+thread_job_declare(feeder);
+thread_job_define_arg(share, struct { atomic_int * count; int * order; int id; });
+thread_job_define_arg(feeder, struct { atomic_int * count; int * order; total_job * total; thread_job_group ** groups; });
+
+thread_job_define_function(share)
+{
+    arg->order[atomic_fetch_add(arg->count, 1)] = arg->id;
+}
+
+thread_job_define_function(feeder)
+{
+    for (int i = 0; i < 2 * WIDTH; i++)
+    {
+	share_job * leaf = share_job_memory_calloc();
+	*share_job_init(leaf) = (share_job_arg){ arg->count, arg->order, i % 2 };
+	thread_job_set_group(share_job_generic(leaf), arg->groups[i % 2]);
+	total_add_job(pool, arg->total, share_job_generic(leaf));
+    }
+}
+
+int main()
+{
+    total_init();
+    share_job_memory_calloc_init();
+    feeder_job_memory_calloc_init();
+
+    atomic_int count = 0;
+    int order[2 * WIDTH];
+    thread_job_group * groups[2] = { thread_job_group_new("light", 1), thread_job_group_new("heavy", 3) };
+
+    total_job * total = total_new(&count, 2 * WIDTH);
+
+    feeder_job * feeder = feeder_job_memory_calloc();
+    *feeder_job_init(feeder) = (feeder_job_arg){ &count, order, total, groups };
+    total_job_add_child(total, feeder_job_generic(feeder));
+    total_job_memory_unlock(total);
+
+    thread_pool_host(1, feeder_job_generic(feeder));
+
+    int heavy = 0;
+
+    for (int i = 0; i < WIDTH / 2; i++)
+    {
+	heavy += order[i];
+    }
+
+    printf("groups heavy %d of %d\n", heavy, WIDTH / 2);
+    assert(heavy >= WIDTH / 2 * 3 / 4 - 1 && heavy <= WIDTH / 2 * 3 / 4 + 1);
+
+    for (int i = 0; i < 2; i++)
+    {
+	thread_job_group_stats stats;
+	thread_job_group_get_stats(groups[i], &stats);
+	assert(stats.jobs_run == WIDTH && stats.queue_depth == 0);
+	thread_job_group_free(groups[i]);
+    }
+
+    return 0;
+}
@@ -0,0 +1,109 @@
+#include "../../thread-pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include "../../../log/log.h"
+
+#define CHUNKS 16
+#define CHUNK_SIZE 4096
+
+thread_job_declare(check);
+thread_job_declare(read);
+thread_job_declare(write);
+thread_job_define_arg(check, struct { int fd; char * buffer; thread_io reads[CHUNKS]; });
+thread_job_define_arg(read, struct { int fd; char * buffer; thread_io writes[CHUNKS]; check_job * check; });
+thread_job_define_arg(write, struct { int fd; read_job * read; });
+
+thread_job_define_function(check)
+{
+    for (int i = 0; i < CHUNKS; i++)
+    {
+	assert(arg->reads[i].result == CHUNK_SIZE);
+	
+	for (int j = 0; j < CHUNK_SIZE; j++)
+	{
+	    assert(arg->buffer[i * CHUNK_SIZE + j] == (char)(i + j));
+	}
+    }
+
+    printf("checked %d chunks\n", CHUNKS);
+
+    free(arg->buffer);
+    thread_pool_quit(pool);
+}
+
+thread_job_define_function(read)
+{
+    for (int i = 0; i < CHUNKS; i++)
+    {
+	assert(arg->writes[i].result == CHUNK_SIZE);
+    }
+
+    free(arg->buffer);
+
+    check_job_arg * check = check_job_get_arg(arg->check);
+
+    check_job_memory_lock(arg->check);
+
+    for (int i = 0; i < CHUNKS; i++)
+    {
+	check->reads[i] = (thread_io){ .op = THREAD_IO_READ, .fd = arg->fd, .buffer = check->buffer + i * CHUNK_SIZE, .size = CHUNK_SIZE, .offset = i * CHUNK_SIZE };
+	thread_pool_add_io(pool, &check->reads[i], check_job_generic(arg->check));
+    }
+
+    check_job_memory_unlock(arg->check);
+}
+
+thread_job_define_function(write)
+{
+    read_job_arg * read = read_job_get_arg(arg->read);
+
+    read->buffer = malloc(CHUNKS * CHUNK_SIZE);
+
+    for (int i = 0; i < CHUNKS * CHUNK_SIZE; i++)
+    {
+	read->buffer[i] = (char)(i / CHUNK_SIZE + i % CHUNK_SIZE);
+    }
+    
+    read_job_memory_lock(arg->read);
+
+    for (int i = 0; i < CHUNKS; i++)
+    {
+	read->writes[i] = (thread_io){ .op = THREAD_IO_WRITE, .fd = arg->fd, .buffer = read->buffer + i * CHUNK_SIZE, .size = CHUNK_SIZE, .offset = i * CHUNK_SIZE };
+	thread_pool_add_io(pool, &read->writes[i], read_job_generic(arg->read));
+    }
+    
+    read_job_memory_unlock(arg->read);
+}
+
+int main()
+{
+    check_job_memory_calloc_init();
+    read_job_memory_calloc_init();
+    write_job_memory_calloc_init();
+
+    FILE * file = tmpfile();
+    assert(file);
+    int fd = fileno(file);
+
+    check_job * check = check_job_memory_calloc();
+    check_job_init(check)->fd = fd;
+    check_job_get_arg(check)->buffer = calloc(CHUNKS, CHUNK_SIZE);
+
+    read_job * read = read_job_memory_calloc();
+    *read_job_init(read) = (read_job_arg){ .fd = fd, .check = check };
+
+    write_job * write = write_job_memory_calloc();
+    *write_job_init(write) = (write_job_arg){ fd, read };
+
+    check_job_memory_unlock(check);
+    read_job_memory_unlock(read);
+    
+    thread_pool_host(2, write_job_generic(write));
+
+    fclose(file);
+    
+    return 0;
+}
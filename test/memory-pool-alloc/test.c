@@ -90,6 +90,17 @@ void test_iteration(test_memory_pool * pool, size_t size)
 	thread_memory_free(ref);
     }
 
+    thread_memory_pool_stats stats;
+
+    test_memory_pool_get_stats(pool, &stats);
+
+    assert(stats.live_count == 0);
+    assert(stats.peak_live_count >= size);
+    assert(stats.free_count >= size);
+    assert(stats.used_bytes == 0);
+    assert(stats.reserved_bytes >= stats.free_count * stats.item_size);
+    assert(stats.segment_count && stats.smallest_segment <= stats.largest_segment);
+
     window_clear(have);
 }
 
@@ -103,6 +114,41 @@ int main()
     test_iteration(pool, 65536);
 
     test_memory_pool_free(pool);
+
+    pool = test_memory_pool_new_options(&(thread_memory_pool_options){ .mmap = true, .huge_pages = true, .prefault = true, .max_segment_count = 4096 });
+
+    test_memory_pool_reserve(pool, 2048);
     
+    test_iteration(pool, 512);
+    test_iteration(pool, 1024);
+    test_iteration(pool, 10240);
+    test_iteration(pool, 65536);
+
+    test_memory_pool_free(pool);
+
+    pool = test_memory_pool_new_options(&(thread_memory_pool_options){ .mmap = true, .huge_pages = true, .max_segment_count = 1 });
+
+    size_t * items[3];
+
+    for (int i = 0; i < 3; i++)
+    {
+	items[i] = test_memory_calloc_from_pool(pool);
+	thread_memory_unlock(items[i]);
+    }
+
+    thread_memory_pool_stats stats;
+    test_memory_pool_get_stats(pool, &stats);
+
+    assert(stats.segment_count == 3 && stats.largest_segment == 1); // page slack does not lift the cap
+    assert(stats.reserved_bytes >= 3 * ((size_t)2 << 20)); // each segment is a huge page sized mapping, not a calloc of one item
+
+    for (int i = 0; i < 3; i++)
+    {
+	thread_memory_lock(items[i]);
+	thread_memory_free(items[i]);
+    }
+
+    test_memory_pool_free(pool);
+
     return 0;
 }
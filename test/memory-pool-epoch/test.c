@@ -0,0 +1,200 @@
+#include "../../memory-pool.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "../../../log/log.h"
+
+#define READERS 4
+#define ROUNDS 1000
+
+thread_memory_pool_declare(version, struct { int a; int b; });
+thread_memory_pool_define_alloc(version);
+
+typedef struct {
+    version_memory * _Atomic shared;
+    atomic_int readers_done;
+    atomic_bool inside;
+    atomic_bool leave;
+    atomic_bool flushed;
+    long long flush_cpu;
+    version_memory_pool * pool;
+}
+    shared_state;
+
+version_memory * version_new(version_memory_pool * pool, int b)
+{
+    version_memory * retval = version_memory_calloc_from_pool(pool);
+    retval->b = b;
+    retval->a = b + 1;
+    version_memory_unlock(retval);
+    return retval;
+}
+
+void * reader_function(void * _state)
+{
+    shared_state * state = _state;
+
+    for (int i = 0; i < ROUNDS; i++)
+    {
+	thread_memory_epoch_enter();
+
+	volatile version_memory * version = atomic_load(&state->shared);
+	int b = version->b;
+
+	for (int j = 0; j < ROUNDS; j++)
+	{
+	    assert(version->b == b && version->a == b + 1); // a reused item would change under the reader
+	}
+
+	thread_memory_epoch_leave();
+    }
+
+    atomic_fetch_add(&state->readers_done, 1);
+
+    return NULL;
+}
+
+void * writer_function(void * _state)
+{
+    shared_state * state = _state;
+
+    for (int i = 0; atomic_load(&state->readers_done) < READERS; i++) // keep writing until every reader is done
+    {
+	version_memory * version = version_memory_calloc_from_peer(atomic_load(&state->shared));
+	version->b = i;
+	version->a = i + 1;
+	version_memory_unlock(version);
+
+	version = atomic_exchange(&state->shared, version);
+	version_memory_lock(version);
+	thread_memory_free_deferred(version);
+    }
+
+    return NULL; // exits with its latest frees still deferred, which become orphans
+}
+
+void * holder_function(void * _state)
+{
+    shared_state * state = _state;
+
+    thread_memory_epoch_enter();
+    atomic_store(&state->inside, true);
+
+    while (!atomic_load(&state->leave))
+    {
+	nanosleep(&(struct timespec){ .tv_nsec = 1000000 }, NULL);
+    }
+
+    thread_memory_epoch_leave();
+
+    return NULL;
+}
+
+void * deferrer_function(void * _state)
+{
+    shared_state * state = _state;
+
+    version_memory * old = atomic_exchange(&state->shared, version_new(state->pool, 1));
+    version_memory_lock(old);
+    thread_memory_free_deferred(old);
+
+    return NULL;
+}
+
+void * flusher_function(void * _state)
+{
+    shared_state * state = _state;
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+    thread_memory_epoch_flush();
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+
+    state->flush_cpu = (end.tv_sec - start.tv_sec) * 1000000000 + end.tv_nsec - start.tv_nsec;
+    atomic_store(&state->flushed, true);
+
+    return NULL;
+}
+
+size_t live_count(version_memory_pool * pool)
+{
+    thread_memory_pool_stats stats;
+    version_memory_pool_get_stats(pool, &stats);
+    return stats.live_count;
+}
+
+void test_readers(version_memory_pool * pool)
+{
+    shared_state state = { .shared = version_new(pool, 0) };
+    pthread_t readers[READERS];
+    pthread_t writer;
+
+    for (int i = 0; i < READERS; i++)
+    {
+	pthread_create(readers + i, NULL, reader_function, &state);
+    }
+
+    pthread_create(&writer, NULL, writer_function, &state);
+
+    for (int i = 0; i < READERS; i++)
+    {
+	pthread_join(readers[i], NULL);
+    }
+
+    pthread_join(writer, NULL);
+
+    assert(!thread_memory_epoch_pending());
+
+    thread_memory_epoch_flush();
+    assert(live_count(pool) == 1); // the orphans of the writer are freed too
+
+    version_memory_lock(state.shared);
+    version_memory_free(state.shared);
+}
+
+void test_flush_waits(version_memory_pool * pool)
+{
+    shared_state state = { .shared = version_new(pool, 0), .pool = pool };
+    pthread_t holder;
+    pthread_t deferrer;
+    pthread_t flusher;
+
+    pthread_create(&holder, NULL, holder_function, &state);
+
+    while (!atomic_load(&state.inside))
+    {
+	nanosleep(&(struct timespec){ .tv_nsec = 1000000 }, NULL);
+    }
+
+    pthread_create(&deferrer, NULL, deferrer_function, &state);
+    pthread_join(deferrer, NULL);
+    
+    pthread_create(&flusher, NULL, flusher_function, &state);
+
+    nanosleep(&(struct timespec){ .tv_nsec = 50000000 }, NULL);
+    assert(!atomic_load(&state.flushed)); // the holder entered before the free, so it may still read the old version
+    assert(live_count(pool) == 2);
+
+    atomic_store(&state.leave, true);
+    pthread_join(holder, NULL);
+    pthread_join(flusher, NULL);
+
+    assert(live_count(pool) == 1);
+    assert(state.flush_cpu < 25000000); // the flusher slept rather than spun while it waited
+
+    version_memory_lock(state.shared);
+    version_memory_free(state.shared);
+}
+
+int main()
+{
+    version_memory_pool * pool = version_memory_pool_new();
+
+    test_readers(pool);
+    test_flush_waits(pool);
+
+    version_memory_pool_free(pool);
+
+    return 0;
+}
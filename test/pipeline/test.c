@@ -0,0 +1,135 @@
+#include "../../thread-pool.h"
+#include "../../channel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include "../../../log/log.h"
+
+#define COUNT 4096
+
+typedef struct {
+    bool ordered;
+    uintptr_t last;
+    atomic_uint_fast64_t sum;
+}
+    sink_state;
+
+thread_job_declare(producer);
+thread_job_declare(finish);
+thread_job_define_arg(finish, struct { sink_state * state; });
+thread_job_define_arg(producer, struct { thread_pipeline * pipeline; sink_state * state; });
+
+void * square(thread_pool * pool, void * item, void * context)
+{
+    uintptr_t value = (uintptr_t) item;
+    return (void*)(value * value);
+}
+
+void * keep_even(thread_pool * pool, void * item, void * context)
+{
+    return (uintptr_t) item % 2 ? NULL : item;
+}
+
+void * sink(thread_pool * pool, void * item, void * context)
+{
+    sink_state * state = context;
+    uintptr_t value = (uintptr_t) item;
+
+    if (state->ordered)
+    {
+	assert(value > state->last);
+	state->last = value;
+    }
+    
+    atomic_fetch_add(&state->sum, value);
+    
+    return NULL;
+}
+
+thread_job_define_function(producer)
+{
+    finish_job * finish = finish_job_memory_calloc();
+    *finish_job_init(finish) = (finish_job_arg){ arg->state };
+    
+    thread_pipeline_start(arg->pipeline, finish_job_generic(finish));
+    
+    for (uintptr_t i = 1; i <= COUNT; i++)
+    {
+	thread_pipeline_push(pool, arg->pipeline, (void*) i);
+    }
+
+    thread_pipeline_close(pool, arg->pipeline);
+}
+
+thread_job_define_function(finish)
+{
+    uint64_t expect = 0;
+
+    for (uint64_t i = 2; i <= COUNT; i += 2)
+    {
+	expect += i * i;
+    }
+
+    printf("pipeline %llu\n", (unsigned long long) atomic_load(&arg->state->sum));
+    assert(atomic_load(&arg->state->sum) == expect);
+    thread_pool_quit(pool);
+}
+
+void test_pipeline(bool ordered)
+{
+    sink_state state = { .ordered = ordered };
+    
+    thread_pipeline * pipeline = thread_pipeline_new(ordered);
+    thread_pipeline_add_stage(pipeline, square, NULL, 4, 16);
+    thread_pipeline_add_stage(pipeline, keep_even, NULL, 2, 8);
+    thread_pipeline_add_stage(pipeline, sink, &state, 2, 8);
+
+    producer_job * producer = producer_job_memory_calloc();
+    *producer_job_init(producer) = (producer_job_arg){ pipeline, &state };
+
+    thread_pool_host(4, producer_job_generic(producer));
+
+    thread_pipeline_free(pipeline);
+}
+
+void test_channel()
+{
+    thread_channel * channel = thread_channel_new(3);
+    void * item;
+    bool done;
+
+    for (uintptr_t i = 1; i <= 4; i++)
+    {
+	done = thread_channel_try_send(channel, (void*) i);
+	assert(done);
+    }
+
+    done = thread_channel_try_send(channel, (void*) 5);
+    assert(!done);
+    assert(thread_channel_count(channel) == 4);
+
+    for (uintptr_t i = 1; i <= 4; i++)
+    {
+	done = thread_channel_try_receive(channel, &item);
+	assert(done && (uintptr_t) item == i);
+    }
+
+    done = thread_channel_try_receive(channel, &item);
+    assert(!done);
+
+    thread_channel_free(channel);
+}
+
+int main()
+{
+    producer_job_memory_calloc_init();
+    finish_job_memory_calloc_init();
+
+    test_channel();
+    test_pipeline(false);
+    test_pipeline(true);
+    
+    return 0;
+}
@@ -0,0 +1,77 @@
+#include "../../thread-pool.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+#include "../total.h"
+#include "../../../log/log.h"
+
+#define WIDTH 40
+
+thread_job_declare(busy);
+thread_job_define_arg(busy, struct { atomic_int * count; uint64_t nanoseconds; });
+
+thread_job_define_function(busy)
+{
+    nanosleep(&(struct timespec){ .tv_nsec = arg->nanoseconds }, NULL);
+    atomic_fetch_add(arg->count, 1);
+}
+
+busy_job * busy_new(atomic_int * count, uint64_t nanoseconds)
+{
+    busy_job * retval = busy_job_memory_calloc();
+    *busy_job_init(retval) = (busy_job_arg){ count, nanoseconds };
+    return retval;
+}
+
+int main()
+{
+    total_init();
+    busy_job_memory_calloc_init();
+
+    atomic_int count = 0;
+
+    total_job * total = total_new(&count, WIDTH + 2);
+    
+    busy_job * head = busy_new(&count, 2000000);
+    busy_job * tail = busy_new(&count, 2000000);
+    busy_job_add_child(tail, busy_job_generic(head));
+    total_job_add_child(total, busy_job_generic(tail));
+    busy_job_memory_unlock(tail);
+
+    for (int i = 0; i < WIDTH; i++)
+    {
+	busy_job * side = busy_new(&count, 100000);
+	busy_job_add_child(side, busy_job_generic(head));
+	total_job_add_child(total, busy_job_generic(side));
+	busy_job_memory_unlock(side);
+    }
+
+    total_job_memory_unlock(total);
+
+    thread_pool_profile profile;
+
+    thread_pool_host_options(&(thread_pool_options){ .worker_count = 4, .profile = &profile }, busy_job_generic(head));
+
+    thread_pool_profile_print(&profile);
+
+    assert(profile.jobs == WIDTH + 3);
+    assert(profile.workers == 4);
+    assert(profile.span >= 4000000 && profile.span <= profile.work); // head then tail, the sides are off the critical path
+    assert(profile.work >= 4000000 + WIDTH * 100000);
+    assert(profile.parallelism > 1);
+    assert(profile.ideal >= profile.span && profile.ideal <= profile.elapsed);
+    assert(profile.critical_count == 3);
+
+    int busy = 0;
+
+    for (size_t i = 0; i < profile.critical_count; i++)
+    {
+	busy += profile.critical[i].function == busy_job_function; // wall times order them, and a preempted total can outlast a side
+    }
+    
+    assert(busy == 2);
+
+    return 0;
+}
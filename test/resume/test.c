@@ -0,0 +1,64 @@
+#include "../../thread-pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include "../total.h"
+#include "../../../log/log.h"
+
+#define WIDTH 40
+
+thread_job_declare(phased);
+thread_job_define_arg(phased, struct { atomic_int * count; int state; int phase; });
+
+thread_job_define_function(phased)
+{
+    thread_job_resume(arg->state);
+
+    for (arg->phase = 1; arg->phase <= 3; arg->phase++)
+    {
+	for (int i = 0; i < WIDTH; i++)
+	{
+	    tally_job * leaf = tally_job_memory_calloc();
+	    *tally_job_init(leaf) = (tally_job_arg){ arg->count };
+	    phased_job_add_child(self, tally_job_generic(leaf));
+	    bool added = thread_pool_add_tally_job(pool, leaf);
+	    assert(added);
+	}
+
+	thread_job_yield(self, arg->state);
+
+	assert(atomic_load(arg->count) == arg->phase * WIDTH);
+    }
+
+    thread_job_yield(self, arg->state); // with no children it is simply queued again
+
+    printf("phased %d\n", atomic_load(arg->count));
+    thread_pool_quit(pool);
+
+    thread_job_resume_end;
+}
+
+void test_resume(const thread_pool_options * options)
+{
+    atomic_int count = 0;
+
+    phased_job * phased = phased_job_memory_calloc();
+    *phased_job_init(phased) = (phased_job_arg){ &count, 0, 0 };
+
+    thread_pool_host_options(options, phased_job_generic(phased)); // on a bounded pool the children overflow rather than run inside their running parent
+
+    assert(count == 3 * WIDTH);
+}
+
+int main()
+{
+    total_init();
+    phased_job_memory_calloc_init();
+    
+    test_resume(&(thread_pool_options){ .worker_count = 4 });
+    test_resume(&(thread_pool_options){ .worker_count = 4, .queue_capacity = 4 });
+    test_resume(&(thread_pool_options){ .worker_count = 1, .queue_capacity = 4 }); // the only worker must not wait for room it has to make
+
+    return 0;
+}
@@ -0,0 +1,82 @@
+#include "../../thread-pool.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "../total.h"
+#include "../../../log/log.h"
+
+thread_job_declare(ticker);
+thread_job_declare(delayed);
+thread_job_declare(starter);
+thread_job_define_arg(ticker, struct { atomic_int * count; thread_cancel_token * token; });
+thread_job_define_arg(delayed, struct { atomic_int * count; struct timespec not_before; });
+thread_job_define_arg(starter, struct { ticker_job * ticker; delayed_job * delayed; });
+
+thread_job_define_function(ticker)
+{
+    if (atomic_fetch_add(arg->count, 1) == 4)
+    {
+	thread_cancel_token_cancel(arg->token);
+    }
+}
+
+thread_job_define_function(delayed)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    assert(now.tv_sec > arg->not_before.tv_sec || (now.tv_sec == arg->not_before.tv_sec && now.tv_nsec >= arg->not_before.tv_nsec));
+    atomic_fetch_add(arg->count, 1);
+}
+
+thread_job_define_function(starter)
+{
+    ticker_job_memory_lock(arg->ticker);
+    delayed_job_memory_lock(arg->delayed);
+    thread_pool_add_job_every(pool, ticker_job_generic(arg->ticker), 2000000);
+    thread_pool_add_job_after(pool, delayed_job_generic(arg->delayed), 20000000);
+}
+
+int main()
+{
+    total_init();
+    ticker_job_memory_calloc_init();
+    delayed_job_memory_calloc_init();
+    starter_job_memory_calloc_init();
+
+    atomic_int count = 0;
+    thread_cancel_token * token = thread_cancel_token_new();
+
+    total_job * total = total_new(&count, 6);
+
+    ticker_job * ticker = ticker_job_memory_calloc();
+    *ticker_job_init(ticker) = (ticker_job_arg){ &count, token };
+    thread_job_set_cancel_token(ticker_job_generic(ticker), token);
+    thread_cancel_token_release(token);
+    total_job_add_child(total, ticker_job_generic(ticker));
+    ticker_job_memory_unlock(ticker); // the starter locks it again on a worker, which is where add_timer unlocks it
+
+    delayed_job * delayed = delayed_job_memory_calloc();
+    delayed_job_arg * delayed_arg = delayed_job_init(delayed);
+    delayed_arg->count = &count;
+    clock_gettime(CLOCK_MONOTONIC, &delayed_arg->not_before);
+    delayed_arg->not_before.tv_nsec += 20000000;
+    if (delayed_arg->not_before.tv_nsec >= 1000000000)
+    {
+	delayed_arg->not_before.tv_sec++;
+	delayed_arg->not_before.tv_nsec -= 1000000000;
+    }
+    total_job_add_child(total, delayed_job_generic(delayed));
+    delayed_job_memory_unlock(delayed);
+    
+    total_job_memory_unlock(total);
+
+    starter_job * starter = starter_job_memory_calloc();
+    *starter_job_init(starter) = (starter_job_arg){ ticker, delayed };
+
+    thread_pool_host(3, starter_job_generic(starter));
+
+    assert(count == 6);
+
+    return 0;
+}
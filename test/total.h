@@ -0,0 +1,50 @@
+#include <stdatomic.h>
+
+thread_job_declare(tally);
+thread_job_declare(total);
+thread_job_define_arg(tally, struct { atomic_int * count; });
+thread_job_define_arg(total, struct { atomic_int * count; int expect; });
+
+thread_job_define_function(tally)
+{
+    atomic_fetch_add(arg->count, 1);
+}
+
+thread_job_define_function(total)
+{
+    assert(atomic_load(arg->count) == arg->expect);
+    thread_pool_quit(pool);
+}
+
+void total_init()
+/**< Sets up the default pools of the tally and total jobs, once per test */
+{
+    tally_job_memory_calloc_init();
+    total_job_memory_calloc_init();
+}
+
+total_job * total_new(atomic_int * count, int expect)
+/**< Returns a locked job that checks count against expect and quits the pool once its children have run */
+{
+    total_job * retval = total_job_memory_calloc();
+    *total_job_init(retval) = (total_job_arg){ count, expect };
+    return retval;
+}
+
+void total_add_job(thread_pool * pool, total_job * total, thread_job * job)
+/**< Makes a locked job a child of an unlocked total, then queues it */
+{
+    total_job_memory_lock(total);
+    total_job_add_child(total, job);
+    total_job_memory_unlock(total);
+    bool added = thread_pool_add_job(pool, job);
+    assert(added);
+}
+
+void total_add_tally(thread_pool * pool, total_job * total, atomic_int * count)
+/**< Queues a job that counts once, as a child of an unlocked total */
+{
+    tally_job * leaf = tally_job_memory_calloc();
+    *tally_job_init(leaf) = (tally_job_arg){ count };
+    total_add_job(pool, total, tally_job_generic(leaf));
+}
@@ -1,8 +1,12 @@
+#define _GNU_SOURCE
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <stdio.h>
+#include <time.h>
 #include "thread-pool.h"
 #include "../range/def.h"
 #include "../range/alloc.h"
@@ -10,6 +14,12 @@
 #include "../window/alloc.h"
 #include "../log/log.h"
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
 
 thread_memory_pool_declare_alloc(thread_job);
 
@@ -20,24 +30,258 @@ thread_memory_pool_declare_alloc(thread_job);
 #define broadcast(target) pthread_cond_broadcast(&(target)->cond)
 
 range_typedef(pthread_t, pthread_t);
+window_typedef(pthread_t, pthread_t);
 range_typedef(thread_job*,thread_job_p);
 window_typedef(thread_job*,thread_job_p);
+range_typedef(size_t,size_t);
+window_typedef(size_t,size_t);
+range_typedef(thread_io*,thread_io_p);
+window_typedef(thread_io*,thread_io_p);
+
+typedef struct {
+    uint64_t deadline;
+    thread_job * job;
+}
+    thread_timer;
+
+#define THREAD_JOB_GROUP_STRIDE ((uint64_t)1 << 20)
+
+struct thread_job_group {
+    char * name;
+    unsigned weight;
+    uint64_t stride;
+    uint64_t pass;
+    thread_pool * pool;
+    window_thread_job_p jobs;
+    atomic_size_t depth;
+    atomic_size_t jobs_run;
+    _Atomic uint64_t cpu_time;
+};
+
+range_typedef(thread_job_group*,thread_job_group_p);
+window_typedef(thread_job_group*,thread_job_group_p);
+
+#define THREAD_TASK_DEQUE_SIZE 1024
+
+typedef struct {
+    _Atomic int64_t top;
+    _Atomic int64_t bottom;
+    _Atomic(thread_task*) tasks[THREAD_TASK_DEQUE_SIZE];
+}
+    thread_task_deque; /**< Fixed size Chase-Lev deque, pushed and taken at the bottom by its worker and stolen from the top by others */
+
+typedef struct {
+    thread_job_function function;
+    uint64_t time;
+    uint64_t path; // nanoseconds along the longest chain ending with this job
+    size_t critical; // the id of the record before it on that chain, or 0
+}
+    thread_job_profile;
+
+range_typedef(thread_job_profile,thread_job_profile);
+window_typedef(thread_job_profile,thread_job_profile);
+
+typedef struct {
+    size_t id;
+    window_thread_job_profile records;
+}
+    thread_job_profile_buffer; /**< Records appended by one worker without locking, record ids combine the buffer id and the record's position */
+
+range_typedef(thread_job_profile_buffer*,thread_job_profile_buffer_p);
+window_typedef(thread_job_profile_buffer*,thread_job_profile_buffer_p);
+
+#define THREAD_JOB_PROFILE_POSITION_BITS 40
+
+typedef struct {
+    thread_task_deque deque;
+    size_t index;
+    size_t domain;
+    bool idle;
+    window_thread_job_p jobs; /**< Jobs queued with affinity for this worker */
+    window_thread_job_p cache; /**< The batch taken from the ready queue, run from the front so that a job waiting in thread_pool_help can run the rest */
+    thread_job_profile_buffer * profile; /**< Where the worker records jobs it finishes, while profiling */
+}
+    thread_worker;
+
+range_typedef(thread_worker*,thread_worker_p);
+window_typedef(thread_worker*,thread_worker_p);
+range_typedef(window_thread_job_p,thread_job_queue);
+window_typedef(window_thread_job_p,thread_job_queue);
+
+range_typedef(thread_timer,thread_timer);
+window_typedef(thread_timer,thread_timer);
+
+#define THREAD_IO_RING_ENTRIES 256
+
+typedef struct {
+    int fd;
+    unsigned * sq_head;
+    unsigned * sq_tail;
+    unsigned sq_mask;
+    unsigned * sq_array;
+    struct io_uring_sqe * sqes;
+    unsigned * cq_head;
+    unsigned * cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe * cqes;
+    void * sq_map;
+    size_t sq_map_size;
+    void * cq_map;
+    size_t cq_map_size;
+    size_t sqes_size;
+    unsigned cq_entries;
+}
+    io_ring;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool started;
+    bool should_quit;
+    pthread_t thread;
+    io_ring ring;
+    bool use_ring;
+    size_t in_flight;
+    window_thread_io_p queue;
+}
+    thread_pool_io;
 
 struct thread_pool {
     pthread_mutex_t mutex;
     pthread_cond_t cond;
+    pthread_cond_t space_cond;
+    pthread_cond_t sync_cond; /**< Where parked syncers sleep, so waking a worker for a job or timer never wakes one of them instead */
     bool should_quit;
-    window_thread_job_p jobs;
+    thread_job_group default_group;
+    window_thread_job_group_p groups;
+    size_t queued;
+    uint64_t virtual_time;
+    size_t queue_capacity;
+    bool fail_when_full;
+    size_t full_waiters;
+    thread_pool_io io;
+    window_thread_timer timers;
+    pthread_t host;
+    window_pthread_t workers;
+    window_pthread_t retired;
+    size_t live_workers;
+    size_t idle_workers;
+    size_t min_workers;
+    size_t max_workers;
+    size_t grow_queue_depth;
+    uint64_t idle_timeout;
+    window_thread_worker_p worker_slots; /**< Running workers by index, NULL where one has retired or not started yet */
+    window_thread_job_queue domains; /**< Jobs queued with affinity for a domain, by domain */
+    size_t affine_queued;
+    bool pin_workers;
+    cpu_set_t pin_cpus; /**< The host's CPUs when the pool started, which workers are pinned among */
+    size_t pin_cpu_count;
+    thread_schedule schedule;
+    uint64_t random_state;
+    bool profile;
+    window_thread_job_profile_buffer_p profiles; /**< Buffers of every worker that ran, while profiling, merged once the pool quits */
+    thread_job_profile_buffer * profile_shared; /**< Records of jobs finished outside the pool's workers, under the pool lock */
+    atomic_size_t thieves;
+    atomic_size_t parked_syncers; /**< Threads sleeping in thread_task_sync until a task of theirs finishes */
+    bool deferred; /**< A worker left with memory it deferred still pending, which the host flushes before returning */
+};
+
+static __thread thread_pool * worker_pool;
+static __thread thread_worker * current_worker;
+
+typedef struct running_job running_job;
+
+struct running_job {
+    thread_job * job;
+    running_job * outer;
+}; /**< Jobs the calling thread is running and holds the locks of, innermost first, kept on the stack of run_job */
+
+static __thread running_job * running;
+
+#define THREAD_JOB_INLINE_PARENTS 2
+#define THREAD_JOB_PARENT_BLOCK_SIZE 14
+
+typedef struct thread_job_parent_block thread_job_parent_block;
+
+struct thread_job_parent_block {
+    thread_job * parents[THREAD_JOB_PARENT_BLOCK_SIZE];
+    thread_job_parent_block * peer;
+};
+
+thread_memory_pool_declare(thread_job_parent_block, thread_job_parent_block);
+thread_memory_pool_define_alloc(thread_job_parent_block);
+thread_memory_pool_declare_default_alloc(thread_job_parent_block);
+thread_memory_pool_define_default_alloc(thread_job_parent_block);
+
+struct thread_cancel_token {
+    atomic_bool cancelled;
+    atomic_size_t references;
 };
 
+thread_memory_pool_declare(thread_cancel_token, thread_cancel_token);
+thread_memory_pool_define_alloc(thread_cancel_token);
+thread_memory_pool_declare_default_alloc(thread_cancel_token);
+thread_memory_pool_define_default_alloc(thread_cancel_token);
+
+typedef struct {
+    size_t count;
+    thread_job * first[THREAD_JOB_INLINE_PARENTS];
+    thread_job_parent_block * more;
+}
+    thread_job_parents;
+
 struct thread_job {
     thread_job_function function;
     size_t dependency_count;
-    thread_job * parent;
+    thread_job_parents parents;
+    thread_job_graph * graph;
+    thread_cancel_token * cancel_token;
+    thread_job_destructor destructor;
+    thread_job_group * group;
+    thread_affinity affinity;
+    size_t affinity_target;
+    uint64_t interval;
+    uint64_t deadline;
     bool waited;
     bool finished;
+    bool suspended;
+    uint64_t profile_time;
+    uint64_t profile_path;
+    size_t profile_critical;
+};
+
+struct thread_job_graph {
+    window_thread_job_p jobs;
+    window_size_t dependency_counts;
+    window_thread_job_p ready;
+    atomic_size_t remaining;
+    thread_job * done;
+    bool sealed;
 };
 
+static pthread_once_t parent_block_init_once = PTHREAD_ONCE_INIT;
+static pthread_once_t cancel_token_init_once = PTHREAD_ONCE_INIT;
+
+inline static bool is_cancelled(thread_cancel_token * token)
+{
+    return token && atomic_load_explicit(&token->cancelled, memory_order_relaxed);
+}
+
+static void thread_job_free(thread_job * job)
+{
+    if (job->destructor)
+    {
+	job->destructor(job + 1);
+    }
+    
+    if (job->cancel_token)
+    {
+	thread_cancel_token_release(job->cancel_token);
+    }
+    
+    thread_job_memory_free(job);
+}
+
 static bool is_in(range_thread_job_p * jobs, thread_job * job)
 {
     thread_job ** i;
@@ -53,9 +297,13 @@ static bool is_in(range_thread_job_p * jobs, thread_job * job)
     return false;
 }
 
-/*static thread_job * pop_random(range_thread_job_p * list)
+static thread_job * pop_random(thread_pool * pool, range_thread_job_p * list)
 {
-    thread_job ** index = list->begin + rand() % range_count(*list);
+    pool->random_state ^= pool->random_state << 13; // xorshift, advanced under the pool lock
+    pool->random_state ^= pool->random_state >> 7;
+    pool->random_state ^= pool->random_state << 17;
+    
+    thread_job ** index = list->begin + pool->random_state % range_count(*list);
 
     thread_job * retval = *index;
 
@@ -66,260 +314,2245 @@ static bool is_in(range_thread_job_p * jobs, thread_job * job)
     assert (!is_in(list, retval));
 
     return retval;
-    }*/
+}
 
-static void start_parent(thread_pool * pool, thread_job * parent)
+inline static thread_job_group * group_of(thread_pool * pool, thread_job * job)
 {
-    if (!parent)
+    return job->group ? job->group : &pool->default_group;
+}
+
+static bool domain_is_live(thread_pool * pool, size_t domain, bool * idle)
+{
+    bool retval = false;
+    thread_worker ** i;
+
+    for_range(i, pool->worker_slots.region)
     {
-	return;
+	if (*i && (*i)->domain == domain)
+	{
+	    retval = true;
+	    *idle = *idle || (*i)->idle;
+	}
     }
+
+    return retval;
+}
+
+static window_thread_job_p * affine_queue(thread_pool * pool, thread_job * job, bool * idle)
+{
+    thread_worker * worker = NULL;
     
-    thread_job_memory_lock(parent);
-    if(parent->dependency_count == 1)
-    {
-	parent->dependency_count = 0;
-		
-	lock(pool);
-	*window_push(pool->jobs) = parent;
-	unlock(pool);
-	signal(pool);
-    }
-    else if (parent->dependency_count > 1)
+    switch (job->affinity)
     {
-	parent->dependency_count--;
+    case THREAD_AFFINITY_SAME_WORKER:
+	worker = worker_pool == pool ? current_worker : NULL;
+	break;
+
+    case THREAD_AFFINITY_WORKER:
+	worker = job->affinity_target < (size_t)range_count(pool->worker_slots.region) ? pool->worker_slots.region.begin[job->affinity_target] : NULL;
+	break;
+
+    case THREAD_AFFINITY_DOMAIN:
+	return domain_is_live(pool, job->affinity_target, idle) ? pool->domains.region.begin + job->affinity_target : NULL;
+
+    default:
+	return NULL;
     }
-    else
+
+    if (!worker)
     {
-	log_error("Parent has 0 dependencies where it should have at least 1, did a job run twice?");
-	abort();
+	return NULL; // the hint names no running worker, any may take the job
     }
-    thread_job_memory_unlock(parent);
+
+    *idle = worker->idle;
+    return &worker->jobs;
 }
 
-static void thread_job_end(thread_job * job)
+static void queue_push_shared(thread_pool * pool, thread_job * job)
 {
-    if (job->waited)
+    thread_job_group * group = group_of(pool, job);
+
+    if (group->pool != pool)
     {
-	job->finished = true;
-	thread_job_memory_signal(job);
-	thread_job_memory_unlock(job);
+	assert(!group->pool);
+	group->pool = pool;
+	*window_push(pool->groups) = group;
     }
-    else
+
+    if (range_is_empty(group->jobs.region) && group->pass < pool->virtual_time)
     {
-	thread_job_memory_free(job);
+	group->pass = pool->virtual_time; // a group that was idle does not get to bank its share
     }
+
+    *window_push(group->jobs) = job;
+    atomic_store_explicit(&group->depth, range_count(group->jobs.region), memory_order_relaxed);
+    pool->queued++;
 }
 
-static void flush_jobs(window_thread_job_p * cache, thread_pool * pool)
+static void queue_push(thread_pool * pool, thread_job * job)
 {
-    while (!range_is_empty(pool->jobs.region))
+    bool idle = false;
+    window_thread_job_p * affine = affine_queue(pool, job, &idle);
+
+    if (!affine)
     {
-	size_t take = range_count(pool->jobs.region);
+	queue_push_shared(pool, job);
+	return;
+    }
 
-	size_t take_cap = 100;
-	
-	if (take > take_cap)
-	{
-	    take = take_cap;
-	}
-	
-	
-	//printf("count %zu\n", take);
-        
-	window_rewrite(*cache);
+    *window_push(*affine) = job;
+    pool->queued++;
+    pool->affine_queued++;
 
-	/*while (take > 0)
-	{
-	    *window_push(*cache) = pop_random(&pool->jobs.region);
-	    take--;
-	    }*/
+    if (idle)
+    {
+	broadcast(pool); // make sure the sleeping owner is among those woken
+    }
+}
 
-	window_alloc(*cache, take);
+static window_thread_job_p * affine_steal_source(thread_pool * pool, thread_worker * self)
+{
+    thread_worker ** i;
 
-	memcpy(cache->region.begin, pool->jobs.region.end - take, take * sizeof(*pool->jobs.region.begin));
-	pool->jobs.region.end -= take;
-	cache->region.end += take;
-	assert(cache->region.end <= cache->alloc.end);
-	
-        unlock(pool);
+    for_range(i, pool->worker_slots.region)
+    {
+	if (*i && *i != self && !(*i)->idle && range_count((*i)->jobs.region) > 1)
+	{
+	    return &(*i)->jobs; // a busy worker keeps its next job, the rest may run elsewhere
+	}
+    }
 
-	thread_job * job;
-	thread_job ** i;
+    window_thread_job_p * domain;
+    
+    for_range(domain, pool->domains.region)
+    {
+	size_t index = domain - pool->domains.region.begin;
+	size_t live = 0;
+	bool idle = false;
 
-	for_range(i, cache->region)
+	for_range(i, pool->worker_slots.region)
 	{
-	    job = *i;
-	    
-	    thread_job_memory_lock(job);
-	    
-	    if (job->dependency_count)
+	    if (*i && (*i)->domain == index)
 	    {
-		thread_job_memory_unlock(job);
-		lock(pool);
-		continue;
+		live++;
+		idle = idle || (*i)->idle;
 	    }
-	    
-	    job->function(job, job->parent, pool, job + 1, pool->should_quit);
-	    
-	    thread_job * parent = job->parent;
-	    
-	    thread_job_end(job);
-	    
-	    start_parent(pool, parent);
 	}
-	
-        lock(pool);
+
+	if (!idle && (size_t)range_count(domain->region) > live)
+	{
+	    return domain;
+	}
     }
+
+    return NULL;
 }
 
-static void * worker_function(void * _pool)
+static window_thread_job_p * affine_source(thread_pool * pool, bool * steal)
 {
-    thread_pool * pool = _pool;
-
-    //thread_job * job;
+    *steal = false;
+    
+    if (!pool->affine_queued)
+    {
+	return NULL;
+    }
 
-    lock(pool);
+    thread_worker * self = worker_pool == pool ? current_worker : NULL;
 
-    window_thread_job_p cache = {0};
+    if (self && !range_is_empty(self->jobs.region))
+    {
+	return &self->jobs;
+    }
     
-    while (true)
+    if (self && self->domain < (size_t)range_count(pool->domains.region) && !range_is_empty(pool->domains.region.begin[self->domain].region))
     {
-	flush_jobs(&cache, pool);
+	return pool->domains.region.begin + self->domain;
+    }
 
-	if (pool->should_quit)
-	{
-	    break;
-	}
-	
-	wait(pool);
+    if (pool->queued > pool->affine_queued)
+    {
+	return NULL; // shared jobs go before stealing
     }
 
-    window_clear(cache);
+    *steal = true;
     
-    unlock(pool);
-
-    return NULL;
-}
-
-size_t thread_pool_job_count(thread_pool * pool)
-{
-    lock(pool);
-    size_t retval = range_count(pool->jobs.region);
-    unlock(pool);
-    return retval;
+    return affine_steal_source(pool, self);
 }
 
-void thread_pool_add_job(thread_pool * pool, thread_job * job)
+static size_t affine_take(thread_pool * pool, window_thread_job_p * cache, size_t take_cap)
 {
-    lock(pool);
-//    log_debug("push %p", job);
-    *window_push(pool->jobs) = job;
-    
-    unlock(pool);
-    thread_job_memory_unlock(job);
-    
-    signal(pool);
-}
+    bool steal;
+    window_thread_job_p * source = affine_source(pool, &steal);
 
-void thread_pool_host(size_t worker_count, thread_job * first_job)
-{
-    if (worker_count)
+    if (!source)
     {
-	worker_count--;
+	return 0;
     }
-    
-    thread_pool pool = {0};
-    pthread_mutex_init(&pool.mutex,NULL);
-    pthread_cond_init(&pool.cond,NULL);
 
-    range_pthread_t workers;
-    range_calloc(workers, worker_count);
-
-    pthread_t * i;
+    size_t take = steal ? 1 : range_count(source->region);
 
-    for_range(i, workers)
+    if (take > take_cap)
     {
-	pthread_create(i, NULL, worker_function, &pool);
+	take = take_cap;
     }
 
-    thread_pool_add_job(&pool, first_job);
-
-    worker_function(&pool);
+    window_rewrite(*cache);
+    window_alloc(*cache, take);
 
-    for_range(i, workers)
+    if (steal)
     {
-	pthread_join(*i, NULL);
+	*cache->region.begin = *source->region.begin++; // steal the oldest, the owner takes from the other end
+    }
+    else
+    {
+	memcpy(cache->region.begin, source->region.end - take, take * sizeof(*source->region.begin));
+	source->region.end -= take;
     }
-
-    assert(range_is_empty(pool.jobs.region));
-
-    window_clear(pool.jobs);
     
-    range_clear(workers);
+    cache->region.end += take;
 
-    pthread_mutex_destroy(&pool.mutex);
-    pthread_cond_destroy(&pool.cond);
-}
+    pool->queued -= take;
+    pool->affine_queued -= take;
 
-void thread_pool_quit(thread_pool * pool)
-{
-    lock(pool);
-    pool->should_quit = true;
-    unlock(pool);
-    broadcast(pool);
+    return take;
 }
 
-thread_job_memory_pool * thread_job_memory_pool_new(size_t arg_size)
+static thread_job_group * queue_choose(thread_pool * pool, bool * contended)
 {
-    return (thread_job_memory_pool*) thread_memory_pool_new(sizeof(thread_job) + arg_size);
-}
+    thread_job_group * retval = NULL;
+    thread_job_group ** i;
+    size_t ready = 0;
 
-void thread_job_add_child(thread_job * parent, thread_job * child)
-{
-    assert(parent);
-    assert(child);
-    child->parent = parent;
-    parent->dependency_count++;
-}
+    for_range(i, pool->groups.region)
+    {
+	if (range_is_empty((*i)->jobs.region))
+	{
+	    continue;
+	}
 
-void * thread_job_init(thread_job * child, thread_job_function function)
-{
-    assert (!child->function);
-    
-    child->function = function;
+	ready++;
 
-    return child + 1;
+	if (!retval || (*i)->pass < retval->pass)
+	{
+	    retval = *i;
+	}
+    }
+
+    *contended = ready > 1;
+
+    assert(retval);
+
+    return retval;
 }
 
-bool thread_pool_should_quit(thread_pool * pool)
+static void queue_took(thread_pool * pool, thread_job_group * group, size_t take)
 {
-    return pool->should_quit;
+    pool->virtual_time = group->pass;
+    group->pass += take * group->stride;
+    pool->queued -= take;
+    atomic_store_explicit(&group->depth, range_count(group->jobs.region), memory_order_relaxed);
+    atomic_fetch_add_explicit(&group->jobs_run, take, memory_order_relaxed);
 }
 
-void thread_job_wait(thread_pool * pool, thread_job * job)
+static bool queue_take(thread_pool * pool, window_thread_job_p * cache, size_t take_cap, thread_job_group ** taken_group)
 {
-    job->waited = true;
-
-    assert(!job->finished);
+    *taken_group = NULL;
+    
+    if (affine_take(pool, cache, take_cap))
+    {
+	return true;
+    }
 
-    if (!job->dependency_count)
+    if (pool->queued == pool->affine_queued)
     {
-	assert(!is_in(&pool->jobs.region, job));
+	return false;
+    }
     
-	lock(pool);
-	*window_push(pool->jobs) = job;
-	unlock(pool);
+    bool contended;
+    thread_job_group * group = queue_choose(pool, &contended);
+    
+    size_t take = range_count(group->jobs.region);
+
+    if (pool->schedule == THREAD_SCHEDULE_ADAPTIVE)
+    {
+	size_t share = (take + pool->live_workers - 1) / pool->live_workers;
+
+	if (take_cap > share)
+	{
+	    take_cap = share; // leave the rest for the other workers rather than running it all here
+	}
     }
-    else
+
+    if (contended && take_cap > group->weight)
     {
-	//assert(is_in(&pool->jobs.region, job));
+	take_cap = group->weight; // share workers in quanta proportional to weight while groups compete
     }
-    
-    while (!job->finished)
+
+    if (take > take_cap)
     {
-	thread_job_memory_wait(job);
+	take = take_cap;
     }
 
-    thread_job_memory_free(job);
+    window_rewrite(*cache);
+    window_alloc(*cache, take);
+
+    switch (pool->schedule)
+    {
+    case THREAD_SCHEDULE_FIFO:
+	memcpy(cache->region.begin, group->jobs.region.begin, take * sizeof(*group->jobs.region.begin));
+	group->jobs.region.begin += take;
+	cache->region.end += take;
+	break;
+
+    case THREAD_SCHEDULE_RANDOM:
+	for (size_t i = 0; i < take; i++)
+	{
+	    *cache->region.end++ = pop_random(pool, &group->jobs.region);
+	}
+	break;
+
+    default:
+	memcpy(cache->region.begin, group->jobs.region.end - take, take * sizeof(*group->jobs.region.begin));
+	group->jobs.region.end -= take;
+	cache->region.end += take;
+	break;
+    }
+    
+    assert(cache->region.end <= cache->alloc.end);
+
+    queue_took(pool, group, take);
+
+    *taken_group = group;
+
+    return true;
+}
+
+static thread_job * queue_pop(thread_pool * pool)
+{
+    bool steal;
+    window_thread_job_p * source = affine_source(pool, &steal);
+
+    if (source)
+    {
+	pool->queued--;
+	pool->affine_queued--;
+	return steal ? *source->region.begin++ : *--source->region.end;
+    }
+
+    if (pool->queued == pool->affine_queued)
+    {
+	return NULL;
+    }
+    
+    bool contended;
+    thread_job_group * group = queue_choose(pool, &contended);
+
+    thread_job * retval;
+
+    switch (pool->schedule)
+    {
+    case THREAD_SCHEDULE_FIFO:
+	retval = *group->jobs.region.begin++;
+	break;
+
+    case THREAD_SCHEDULE_RANDOM:
+	retval = pop_random(pool, &group->jobs.region);
+	break;
+
+    default:
+	retval = *--group->jobs.region.end;
+	break;
+    }
+
+    queue_took(pool, group, 1);
+
+    return retval;
+}
+
+static void start_parent(thread_pool * pool, thread_job * parent, uint64_t path, size_t critical)
+{
+    thread_job_memory_lock(parent);
+
+    if (path > parent->profile_path)
+    {
+	parent->profile_path = path;
+	parent->profile_critical = critical;
+    }
+    
+    if(parent->dependency_count == 1)
+    {
+	parent->dependency_count = 0;
+		
+	lock(pool);
+	queue_push(pool, parent);
+	unlock(pool);
+	signal(pool);
+    }
+    else if (parent->dependency_count > 1)
+    {
+	parent->dependency_count--;
+    }
+    else
+    {
+	log_error("Parent has 0 dependencies where it should have at least 1, did a job run twice?");
+	abort();
+    }
+    thread_job_memory_unlock(parent);
+}
+
+static void free_parent_blocks(thread_job_parents * parents)
+{
+    thread_job_parent_block * block;
+    
+    while ( (block = parents->more) )
+    {
+	parents->more = block->peer;
+	thread_job_parent_block_memory_lock(block);
+	thread_job_parent_block_memory_free(block);
+    }
+}
+
+static void start_parents(thread_pool * pool, thread_job_parents * parents, bool keep_blocks, uint64_t path, size_t critical)
+{
+    size_t inline_count = parents->count < THREAD_JOB_INLINE_PARENTS ? parents->count : THREAD_JOB_INLINE_PARENTS;
+
+    for (size_t i = 0; i < inline_count; i++)
+    {
+	start_parent(pool, parents->first[i], path, critical);
+    }
+
+    size_t block_fill = (parents->count - inline_count) % THREAD_JOB_PARENT_BLOCK_SIZE;
+    
+    if (!block_fill)
+    {
+	block_fill = THREAD_JOB_PARENT_BLOCK_SIZE;
+    }
+    
+    for (thread_job_parent_block * block = parents->more; block; block = block->peer)
+    {
+	for (size_t i = 0; i < block_fill; i++)
+	{
+	    start_parent(pool, block->parents[i], path, critical);
+	}
+
+	block_fill = THREAD_JOB_PARENT_BLOCK_SIZE;
+    }
+
+    if (!keep_blocks)
+    {
+	free_parent_blocks(parents);
+    }
+}
+
+static bool is_running(thread_job * job)
+{
+    for (running_job * i = running; i; i = i->outer)
+    {
+	if (i->job == job)
+	{
+	    return true;
+	}
+    }
+
+    return false;
+}
+
+static bool has_running_parent(thread_job_parents * parents)
+{
+    size_t inline_count = parents->count < THREAD_JOB_INLINE_PARENTS ? parents->count : THREAD_JOB_INLINE_PARENTS;
+
+    for (size_t i = 0; i < inline_count; i++)
+    {
+	if (is_running(parents->first[i]))
+	{
+	    return true;
+	}
+    }
+
+    size_t block_fill = (parents->count - inline_count) % THREAD_JOB_PARENT_BLOCK_SIZE;
+    
+    if (!block_fill)
+    {
+	block_fill = THREAD_JOB_PARENT_BLOCK_SIZE;
+    }
+    
+    for (thread_job_parent_block * block = parents->more; block; block = block->peer)
+    {
+	for (size_t i = 0; i < block_fill; i++)
+	{
+	    if (is_running(block->parents[i]))
+	    {
+		return true;
+	    }
+	}
+
+	block_fill = THREAD_JOB_PARENT_BLOCK_SIZE;
+    }
+
+    return false;
+}
+
+static void graph_job_end(thread_pool * pool, thread_job_graph * graph)
+{
+    thread_job * done = graph->done;
+	
+    if (1 == atomic_fetch_sub(&graph->remaining, 1) && done)
+    {
+	start_parent(pool, done, 0, 0);
+    }
+}
+
+static void thread_job_end(thread_job * job)
+{
+    if (job->graph)
+    {
+	thread_job_memory_unlock(job); // the graph keeps it, graph_job_end counts it once its parents are started
+    }
+    else if (job->waited)
+    {
+	job->finished = true;
+	thread_job_memory_signal(job);
+	thread_job_memory_unlock(job);
+    }
+    else
+    {
+	thread_job_free(job);
+    }
+}
+
+inline static uint64_t monotonic_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static bool timer_push(thread_pool * pool, thread_job * job, uint64_t deadline)
+{
+    range_thread_timer * heap = &pool->timers.region;
+    
+    *window_push(pool->timers) = (thread_timer){ .deadline = deadline, .job = job };
+
+    size_t i = range_count(*heap) - 1;
+    
+    while (i)
+    {
+	size_t up = (i - 1) / 2;
+
+	if (heap->begin[up].deadline <= heap->begin[i].deadline)
+	{
+	    break;
+	}
+
+	thread_timer swap = heap->begin[up];
+	heap->begin[up] = heap->begin[i];
+	heap->begin[i] = swap;
+	i = up;
+    }
+
+    return !i;
+}
+
+static thread_job * timer_pop(thread_pool * pool)
+{
+    range_thread_timer * heap = &pool->timers.region;
+
+    thread_job * retval = heap->begin->job;
+
+    heap->end--;
+    *heap->begin = *heap->end;
+
+    size_t count = range_count(*heap);
+    size_t i = 0;
+
+    while (true)
+    {
+	size_t least = i;
+	size_t left = 2 * i + 1;
+	size_t right = left + 1;
+
+	if (left < count && heap->begin[left].deadline < heap->begin[least].deadline)
+	{
+	    least = left;
+	}
+
+	if (right < count && heap->begin[right].deadline < heap->begin[least].deadline)
+	{
+	    least = right;
+	}
+
+	if (least == i)
+	{
+	    break;
+	}
+
+	thread_timer swap = heap->begin[least];
+	heap->begin[least] = heap->begin[i];
+	heap->begin[i] = swap;
+	i = least;
+    }
+
+    return retval;
+}
+
+static void fire_timers(thread_pool * pool)
+{
+    if (range_is_empty(pool->timers.region))
+    {
+	return;
+    }
+
+    uint64_t now = pool->should_quit ? UINT64_MAX : monotonic_now();
+
+    while (!range_is_empty(pool->timers.region) && pool->timers.region.begin->deadline <= now)
+    {
+	queue_push(pool, timer_pop(pool));
+    }
+}
+
+static void add_timer(thread_pool * pool, thread_job * job, uint64_t deadline)
+{
+    job->deadline = deadline;
+    
+    lock(pool);
+    bool earliest = timer_push(pool, job, deadline);
+    unlock(pool);
+    thread_job_memory_unlock(job);
+
+    if (earliest)
+    {
+	signal(pool); // idle workers sleep until the old earliest deadline, one has to wake to wait for this one instead
+    }
+}
+
+static void maybe_grow(thread_pool * pool);
+static void reap_retired(thread_pool * pool);
+
+static thread_job_profile_buffer * profile_buffer_new(thread_pool * pool)
+{
+    // called with the pool locked
+    
+    thread_job_profile_buffer * retval = calloc(1, sizeof(*retval));
+    retval->id = range_count(pool->profiles.region);
+    *window_push(pool->profiles) = retval;
+    return retval;
+}
+
+static size_t profile_record(thread_pool * pool, thread_job * job)
+{
+    thread_job_profile_buffer * buffer = worker_pool == pool && current_worker ? current_worker->profile : NULL;
+
+    if (!buffer)
+    {
+	lock(pool);
+	buffer = pool->profile_shared;
+    }
+    
+    *window_push(buffer->records) = (thread_job_profile){ job->function, job->profile_time, job->profile_path, job->profile_critical };
+
+    size_t retval = buffer->id << THREAD_JOB_PROFILE_POSITION_BITS | range_count(buffer->records.region);
+
+    if (buffer == pool->profile_shared)
+    {
+	unlock(pool);
+    }
+
+    return retval;
+}
+
+static thread_job_profile * profile_find(thread_pool * pool, size_t id)
+{
+    thread_job_profile_buffer * buffer = pool->profiles.region.begin[id >> THREAD_JOB_PROFILE_POSITION_BITS];
+    return buffer->records.region.begin + (id & (((size_t) 1 << THREAD_JOB_PROFILE_POSITION_BITS) - 1)) - 1;
+}
+
+static void run_job(thread_pool * pool, thread_job * job)
+{
+    if (!is_cancelled(job->cancel_token))
+    {
+	uint64_t start = pool->profile ? monotonic_now() : 0;
+	running_job frame = { job, running };
+
+	running = &frame;
+	job->function(job, job->parents.count ? job->parents.first[0] : NULL, pool, job + 1, pool->should_quit);
+	running = frame.outer;
+
+	if (pool->profile)
+	{
+	    uint64_t time = monotonic_now() - start;
+	    job->profile_time += time;
+	    job->profile_path += time; // children that finish after a suspend raise the path before the next phase adds to it
+	}
+
+	if (job->suspended)
+	{
+	    job->suspended = false;
+
+	    if (!job->dependency_count) // nothing to wait for, or it all finished while the job held its lock
+	    {
+		lock(pool);
+		queue_push(pool, job);
+		unlock(pool);
+		signal(pool);
+	    }
+	    
+	    thread_job_memory_unlock(job); // children finishing later queue it through start_parent
+	    return;
+	}
+
+	if (job->interval && !thread_job_should_quit(pool, job))
+	{
+	    add_timer(pool, job, job->deadline + job->interval);
+	    return;
+	}
+    }
+	    
+    thread_job_parents parents = job->parents;
+    thread_job_graph * graph = job->graph;
+    bool keep_blocks = graph;
+    uint64_t path = job->profile_path;
+    size_t critical = pool->profile ? profile_record(pool, job) : 0;
+
+    if (keep_blocks)
+    {
+	job->profile_time = job->profile_path = job->profile_critical = 0; // graph jobs run again on the next launch
+    }
+	    
+    thread_job_end(job);
+	    
+    start_parents(pool, &parents, keep_blocks, path, critical);
+
+    if (graph)
+    {
+	graph_job_end(pool, graph); // only now may the graph finish and be freed along with its parent blocks
+    }
+}
+
+inline static uint64_t thread_cpu_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static uint64_t charge_cpu_time(thread_job_group * group, uint64_t start)
+{
+    uint64_t now = thread_cpu_now();
+
+    if (group)
+    {
+	atomic_fetch_add_explicit(&group->cpu_time, now - start, memory_order_relaxed);
+    }
+
+    return now;
+}
+
+static bool flush_jobs(window_thread_job_p * cache, thread_pool * pool)
+{
+    bool ran = false;
+    
+    size_t take_cap = 100;
+	
+    thread_job_group * group;
+    
+    while (fire_timers(pool), queue_take(pool, cache, take_cap, &group))
+    {
+	ran = true;
+	
+	if (pool->full_waiters)
+	{
+	    pthread_cond_broadcast(&pool->space_cond);
+	}
+
+	maybe_grow(pool);
+	
+        unlock(pool);
+
+	thread_job * job;
+
+	thread_job_group * charged = group; // affine batches can mix groups, so they are charged from job to job
+	uint64_t start = thread_cpu_now();
+
+	while (!range_is_empty(cache->region))
+	{
+	    job = *cache->region.begin++;
+	    
+	    thread_job_memory_lock(job);
+	    
+	    if (job->dependency_count)
+	    {
+		thread_job_memory_unlock(job);
+		continue;
+	    }
+
+	    if (!group && group_of(pool, job) != charged)
+	    {
+		start = charge_cpu_time(charged, start);
+		charged = group_of(pool, job);
+	    }
+
+	    thread_memory_epoch_enter();
+	    run_job(pool, job);
+	    thread_memory_epoch_leave();
+	}
+
+	charge_cpu_time(charged, start);
+
+	thread_memory_epoch_collect();
+	
+        lock(pool);
+    }
+
+    return ran;
+}
+
+static bool deque_push(thread_task_deque * deque, thread_task * task)
+{
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+
+    if (bottom - top >= THREAD_TASK_DEQUE_SIZE)
+    {
+	return false;
+    }
+
+    atomic_store_explicit(&deque->tasks[bottom % THREAD_TASK_DEQUE_SIZE], task, memory_order_relaxed);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_release);
+
+    return true;
+}
+
+static thread_task * deque_take(thread_task_deque * deque)
+{
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if (top > bottom)
+    {
+	atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+	return NULL;
+    }
+
+    thread_task * task = atomic_load_explicit(&deque->tasks[bottom % THREAD_TASK_DEQUE_SIZE], memory_order_relaxed);
+
+    if (top == bottom)
+    {
+	if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed))
+	{
+	    task = NULL;
+	}
+	
+	atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+
+    return task;
+}
+
+static thread_task * deque_steal(thread_task_deque * deque)
+{
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+
+    if (top >= bottom)
+    {
+	return NULL;
+    }
+
+    thread_task * task = atomic_load_explicit(&deque->tasks[top % THREAD_TASK_DEQUE_SIZE], memory_order_relaxed);
+
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed))
+    {
+	return NULL;
+    }
+
+    return task;
+}
+
+static thread_task * steal_task(thread_pool * pool)
+{
+    // called with the pool locked, which keeps the set of workers still
+    thread_worker ** i;
+    thread_task * task;
+
+    for_range(i, pool->worker_slots.region)
+    {
+	if (*i && *i != current_worker && (task = deque_steal(&(*i)->deque)))
+	{
+	    return task;
+	}
+    }
+
+    return NULL;
+}
+
+#define THREAD_TASK_SYNC_SPINS 16
+
+static void run_task(thread_pool * pool, thread_task * task)
+{
+    thread_task_scope * scope = task->scope;
+    
+    task->function(pool, task->arg);
+
+    if (1 == atomic_fetch_sub(&scope->pending, 1) && atomic_load(&pool->parked_syncers)) // the task and its scope may be gone after this
+    {
+	lock(pool);
+	pthread_cond_broadcast(&pool->sync_cond);
+	unlock(pool);
+    }
+}
+
+static void register_worker(thread_pool * pool, thread_worker * worker)
+{
+    bool is_host = pthread_equal(pthread_self(), pool->host);
+    
+    if (range_is_empty(pool->worker_slots.region))
+    {
+	*window_push(pool->worker_slots) = NULL; // index 0 is kept for the host
+    }
+
+    thread_worker ** slot = pool->worker_slots.region.begin;
+
+    if (!is_host)
+    {
+	for (slot++; slot < pool->worker_slots.region.end && *slot; slot++)
+	{
+	}
+
+	if (slot == pool->worker_slots.region.end)
+	{
+	    slot = window_push(pool->worker_slots);
+	    *slot = NULL;
+	}
+    }
+
+    assert(!*slot);
+    *slot = worker;
+    worker->index = slot - pool->worker_slots.region.begin;
+
+    if (pool->profile)
+    {
+	worker->profile = profile_buffer_new(pool); // kept by the pool after the worker exits, for the report
+    }
+
+    if (pool->pin_workers && !is_host)
+    {
+	size_t nth = (worker->index - 1) % pool->pin_cpu_count;
+	size_t cpu = 0;
+
+	for (;; cpu++)
+	{
+	    if (CPU_ISSET(cpu, &pool->pin_cpus) && !nth--)
+	    {
+		break;
+	    }
+	}
+	
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu, &cpus);
+	
+	if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus))
+	{
+	    log_error("Failed to pin worker %zu", worker->index);
+	}
+    }
+
+    unsigned cpu, node;
+    
+    worker->domain = syscall(SYS_getcpu, &cpu, &node, NULL) ? 0 : node;
+
+    while ((size_t)range_count(pool->domains.region) <= worker->domain)
+    {
+	*window_push(pool->domains) = (window_thread_job_p){0};
+    }
+    
+    current_worker = worker;
+}
+
+static void unregister_worker(thread_pool * pool, thread_worker * worker)
+{
+    pool->worker_slots.region.begin[worker->index] = NULL;
+    current_worker = NULL;
+
+    assert(!deque_take(&worker->deque));
+
+    window_thread_job_p * domain = pool->domains.region.begin + worker->domain;
+    bool idle = false;
+    
+    window_thread_job_p * orphans[] = { &worker->jobs, domain_is_live(pool, worker->domain, &idle) ? NULL : domain };
+    thread_job ** i;
+    
+    for (size_t j = 0; j < sizeof(orphans) / sizeof(*orphans); j++)
+    {
+	if (!orphans[j])
+	{
+	    continue;
+	}
+	
+	for_range(i, orphans[j]->region)
+	{
+	    pool->queued--;
+	    pool->affine_queued--;
+	    queue_push_shared(pool, *i);
+	}
+
+	window_rewrite(*orphans[j]);
+    }
+
+    window_clear(worker->jobs);
+}
+
+static void retire(thread_pool * pool)
+{
+    pthread_t self = pthread_self();
+    pthread_t * i;
+
+    for_range(i, pool->workers.region)
+    {
+	if (pthread_equal(*i, self))
+	{
+	    *i = *--pool->workers.region.end;
+	    break;
+	}
+    }
+
+    *window_push(pool->retired) = self;
+    pool->live_workers--;
+}
+
+static void * worker_function(void * _pool)
+{
+    thread_pool * pool = _pool;
+
+    //thread_job * job;
+
+    worker_pool = pool;
+
+    lock(pool);
+
+    bool can_retire = pool->max_workers && !pthread_equal(pthread_self(), pool->host);
+    uint64_t idle_since = 0;
+
+    thread_worker worker = {0};
+    register_worker(pool, &worker);
+
+    thread_task * task;
+    
+    while (true)
+    {
+	bool ran = flush_jobs(&worker.cache, pool);
+
+	if (pool->should_quit)
+	{
+	    break;
+	}
+
+	if ((task = steal_task(pool)))
+	{
+	    unlock(pool);
+	    run_task(pool, task);
+	    lock(pool);
+	    continue;
+	}
+
+	if (!range_is_empty(pool->retired.region))
+	{
+	    reap_retired(pool); // an idle worker joins retired ones, rather than whoever grows the pool next
+	    continue;
+	}
+
+	uint64_t deadline = UINT64_MAX;
+	uint64_t idle_deadline = UINT64_MAX;
+
+	if (can_retire && pool->live_workers > pool->min_workers)
+	{
+	    if (ran || !idle_since)
+	    {
+		idle_since = monotonic_now();
+	    }
+	    
+	    deadline = idle_deadline = idle_since + pool->idle_timeout;
+	}
+	else
+	{
+	    idle_since = 0;
+	}
+
+	if (!range_is_empty(pool->timers.region) && pool->timers.region.begin->deadline < deadline)
+	{
+	    deadline = pool->timers.region.begin->deadline;
+	}
+
+	pool->idle_workers++;
+	atomic_fetch_add(&pool->thieves, 1);
+
+	if ((task = steal_task(pool))) // a spawner that missed the thieves count pushed before this look
+	{
+	    atomic_fetch_sub(&pool->thieves, 1);
+	    pool->idle_workers--;
+	    unlock(pool);
+	    run_task(pool, task);
+	    lock(pool);
+	    continue;
+	}
+
+	worker.idle = true;
+	
+	if (deadline == UINT64_MAX)
+	{
+	    wait(pool);
+	}
+	else
+	{
+	    struct timespec until = { .tv_sec = deadline / 1000000000, .tv_nsec = deadline % 1000000000 };
+	    pthread_cond_timedwait(&pool->cond, &pool->mutex, &until);
+	}
+
+	worker.idle = false;
+	
+	atomic_fetch_sub(&pool->thieves, 1);
+	pool->idle_workers--;
+
+	if (idle_deadline != UINT64_MAX
+	    && !pool->queued
+	    && !pool->should_quit
+	    && pool->live_workers > pool->min_workers
+	    && monotonic_now() >= idle_deadline)
+	{
+	    retire(pool);
+	    break;
+	}
+    }
+
+    pool->deferred = pool->deferred || thread_memory_epoch_pending();
+    
+    unregister_worker(pool, &worker);
+    
+    window_clear(worker.cache);
+    
+    unlock(pool);
+
+    worker_pool = NULL;
+
+    return NULL;
+}
+
+static void spawn_worker(thread_pool * pool)
+{
+    pthread_t * thread = window_push(pool->workers);
+    
+    if (pthread_create(thread, NULL, worker_function, pool))
+    {
+	log_error("Failed to start a worker thread");
+	pool->workers.region.end--;
+	return;
+    }
+
+    pool->live_workers++;
+}
+
+static void reap_retired(thread_pool * pool)
+{
+    // called with the pool locked, which is dropped while joining so nobody waits on a thread's teardown behind it
+    
+    while (!range_is_empty(pool->retired.region))
+    {
+	pthread_t thread = *--pool->retired.region.end;
+	unlock(pool);
+	pthread_join(thread, NULL);
+	lock(pool);
+    }
+}
+
+static void maybe_grow(thread_pool * pool)
+{
+    if (pool->live_workers >= pool->max_workers
+	|| pool->idle_workers
+	|| pool->should_quit
+	|| pool->queued <= pool->grow_queue_depth * pool->live_workers)
+    {
+	return;
+    }
+
+    spawn_worker(pool);
+}
+
+size_t thread_pool_job_count(thread_pool * pool)
+{
+    lock(pool);
+    size_t retval = pool->queued;
+    unlock(pool);
+    return retval;
+}
+
+size_t thread_pool_worker_count(thread_pool * pool)
+{
+    lock(pool);
+    size_t retval = pool->live_workers;
+    unlock(pool);
+    return retval;
+}
+
+inline static bool queue_is_full(thread_pool * pool)
+{
+    return pool->queue_capacity && pool->queued >= pool->queue_capacity;
+}
+
+bool thread_pool_add_job(thread_pool * pool, thread_job * job)
+{
+    lock(pool);
+
+    if (queue_is_full(pool))
+    {
+	if (worker_pool == pool)
+	{
+	    if (!job->dependency_count && !has_running_parent(&job->parents))
+	    {
+		unlock(pool);
+		run_job(pool, job);
+		return true;
+	    }
+
+	    // ending the job would relock a parent running here, and a worker that waits for room may be
+	    // the one that has to make it, so the job goes over capacity as released parents do
+	}
+	else if (pool->fail_when_full)
+	{
+	    unlock(pool);
+	    return false;
+	}
+	else
+	{
+	    pool->full_waiters++;
+	
+	    while (queue_is_full(pool))
+	    {
+		pthread_cond_wait(&pool->space_cond, &pool->mutex);
+	    }
+	
+	    pool->full_waiters--;
+	}
+    }
+    
+//    log_debug("push %p", job);
+    queue_push(pool, job);
+
+    if (pool->max_workers)
+    {
+	maybe_grow(pool);
+    }
+    
+    unlock(pool);
+    thread_job_memory_unlock(job);
+    
+    signal(pool);
+
+    return true;
+}
+
+inline static int io_uring_setup_syscall(unsigned entries, struct io_uring_params * params)
+{
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+inline static int io_uring_enter_syscall(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static bool io_ring_init(io_ring * ring)
+{
+    struct io_uring_params params = {0};
+
+    ring->fd = io_uring_setup_syscall(THREAD_IO_RING_ENTRIES, &params);
+
+    if (ring->fd < 0)
+    {
+	return false;
+    }
+
+    if (!(params.features & IORING_FEAT_RW_CUR_POS)) // before 5.6 IORING_OP_READ, IORING_OP_WRITE and offset -1 all fail with EINVAL
+    {
+	close(ring->fd);
+	return false;
+    }
+
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->cq_entries = params.cq_entries;
+
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+    if (ring->sq_map == MAP_FAILED || ring->cq_map == MAP_FAILED || ring->sqes == MAP_FAILED)
+    {
+	log_error("Failed to map io_uring, falling back to an I/O thread");
+	
+	if (ring->sq_map != MAP_FAILED) munmap(ring->sq_map, ring->sq_map_size);
+	if (ring->cq_map != MAP_FAILED) munmap(ring->cq_map, ring->cq_map_size);
+	if (ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+	close(ring->fd);
+	return false;
+    }
+
+    uint8_t * sq = ring->sq_map;
+    uint8_t * cq = ring->cq_map;
+    
+    ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    return true;
+}
+
+static void io_ring_clear(io_ring * ring)
+{
+    munmap(ring->sq_map, ring->sq_map_size);
+    munmap(ring->cq_map, ring->cq_map_size);
+    munmap(ring->sqes, ring->sqes_size);
+    close(ring->fd);
+}
+
+static int io_ring_submit(io_ring * ring, thread_io * io)
+{
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & ring->sq_mask;
+    
+    struct io_uring_sqe * sqe = ring->sqes + index;
+
+    *sqe = (struct io_uring_sqe){0};
+
+    if (io)
+    {
+	sqe->opcode = io->op == THREAD_IO_WRITE ? IORING_OP_WRITE : IORING_OP_READ;
+	sqe->fd = io->fd;
+	sqe->addr = (uintptr_t) io->buffer;
+	sqe->len = io->size;
+	sqe->off = io->offset < 0 ? (uint64_t) -1 : (uint64_t) io->offset;
+    }
+    else
+    {
+	sqe->opcode = IORING_OP_NOP;
+    }
+    
+    sqe->user_data = (uintptr_t) io;
+    
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    int status;
+    
+    while ((status = io_uring_enter_syscall(ring->fd, 1, 0, 0)) < 0 && errno == EINTR)
+    {
+    }
+
+    if (status < 1)
+    {
+	int error = status < 0 ? errno : EAGAIN;
+	__atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE); // the kernel took nothing, so a later submit must not pick it up
+	return -error;
+    }
+
+    return 0;
+}
+
+static void io_complete(thread_pool * pool, thread_io * io, ssize_t result)
+{
+    io->result = result;
+    thread_job_release(pool, io->parent);
+}
+
+static void io_ring_loop(thread_pool * pool)
+{
+    thread_pool_io * context = &pool->io;
+    io_ring * ring = &context->ring;
+    
+    while (true)
+    {
+	unsigned head = *ring->cq_head;
+
+	if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+	{
+	    io_uring_enter_syscall(ring->fd, 0, 1, IORING_ENTER_GETEVENTS);
+	    continue;
+	}
+
+	struct io_uring_cqe * cqe = ring->cqes + (head & ring->cq_mask);
+	thread_io * io = (thread_io*)(uintptr_t) cqe->user_data;
+	ssize_t result = cqe->res;
+	
+	__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+
+	lock(context);
+	context->in_flight--;
+	bool done = context->should_quit && !context->in_flight;
+	unlock(context);
+	broadcast(context);
+	
+	if (io)
+	{
+	    io_complete(pool, io, result);
+	}
+	
+	if (done)
+	{
+	    return;
+	}
+    }
+}
+
+static void io_thread_loop(thread_pool * pool)
+{
+    thread_pool_io * context = &pool->io;
+
+    lock(context);
+
+    while (true)
+    {
+	while (range_is_empty(context->queue.region))
+	{
+	    if (context->should_quit)
+	    {
+		unlock(context);
+		return;
+	    }
+	    
+	    wait(context);
+	}
+
+	thread_io * io = *context->queue.region.begin++;
+	
+	unlock(context);
+
+	ssize_t result;
+
+	if (io->op == THREAD_IO_WRITE)
+	{
+	    result = io->offset < 0 ? write(io->fd, io->buffer, io->size) : pwrite(io->fd, io->buffer, io->size, io->offset);
+	}
+	else
+	{
+	    result = io->offset < 0 ? read(io->fd, io->buffer, io->size) : pread(io->fd, io->buffer, io->size, io->offset);
+	}
+
+	io_complete(pool, io, result < 0 ? -errno : result);
+	
+	lock(context);
+    }
+}
+
+static void * io_function(void * _pool)
+{
+    thread_pool * pool = _pool;
+
+    if (pool->io.use_ring)
+    {
+	io_ring_loop(pool);
+    }
+    else
+    {
+	io_thread_loop(pool);
+    }
+
+    return NULL;
+}
+
+static void io_stop(thread_pool_io * context)
+{
+    lock(context);
+    
+    context->should_quit = true;
+
+    if (context->use_ring)
+    {
+	context->in_flight++;
+
+	int error = io_ring_submit(&context->ring, NULL);
+	
+	if (error)
+	{
+	    log_error("Failed to wake the io_uring thread: %s", strerror(-error));
+	    abort();
+	}
+    }
+    
+    unlock(context);
+    broadcast(context);
+
+    pthread_join(context->thread, NULL);
+
+    if (context->use_ring)
+    {
+	io_ring_clear(&context->ring);
+    }
+
+    window_clear(context->queue);
+    pthread_mutex_destroy(&context->mutex);
+    pthread_cond_destroy(&context->cond);
+}
+
+void thread_pool_add_io(thread_pool * pool, thread_io * io, thread_job * parent)
+{
+    thread_pool_io * context = &pool->io;
+
+    io->parent = parent;
+    io->result = 0;
+    thread_job_add_dependency(parent);
+
+    lock(pool);
+    
+    if (!context->started)
+    {
+	pthread_mutex_init(&context->mutex, NULL);
+	pthread_cond_init(&context->cond, NULL);
+	context->use_ring = io_ring_init(&context->ring);
+	pthread_create(&context->thread, NULL, io_function, pool);
+	context->started = true;
+    }
+    
+    unlock(pool);
+
+    lock(context);
+
+    int error = 0;
+    
+    if (context->use_ring)
+    {
+	while (context->in_flight >= context->ring.cq_entries)
+	{
+	    wait(context);
+	}
+
+	context->in_flight++;
+	
+	if ((error = io_ring_submit(&context->ring, io)))
+	{
+	    context->in_flight--;
+	}
+    }
+    else
+    {
+	*window_push(context->queue) = io;
+	signal(context);
+    }
+    
+    unlock(context);
+
+    if (error)
+    {
+	io_complete(pool, io, error); // fail the request rather than leave its parent waiting forever
+    }
+}
+
+void thread_pool_add_job_at(thread_pool * pool, thread_job * job, const struct timespec * deadline)
+{
+    add_timer(pool, job, (uint64_t) deadline->tv_sec * 1000000000 + deadline->tv_nsec);
+}
+
+void thread_pool_add_job_after(thread_pool * pool, thread_job * job, uint64_t nanoseconds)
+{
+    add_timer(pool, job, monotonic_now() + nanoseconds);
+}
+
+void thread_pool_add_job_every(thread_pool * pool, thread_job * job, uint64_t nanoseconds)
+{
+    assert(nanoseconds);
+    assert(!job->graph);
+    assert(!job->waited);
+    
+    job->interval = nanoseconds;
+    add_timer(pool, job, monotonic_now() + nanoseconds);
+}
+
+static void profile_report(thread_pool * pool, thread_pool_profile * profile, uint64_t elapsed, size_t workers)
+{
+    *profile = (thread_pool_profile){ .workers = workers, .elapsed = elapsed };
+
+    thread_job_profile_buffer ** buffer;
+    thread_job_profile * i;
+    thread_job_profile * last = NULL;
+
+    for_range(buffer, pool->profiles.region)
+    {
+	profile->jobs += range_count((*buffer)->records.region);
+	
+	for_range(i, (*buffer)->records.region)
+	{
+	    profile->work += i->time;
+
+	    if (!last || i->path > last->path)
+	    {
+		last = i;
+	    }
+	}
+    }
+
+    if (!last)
+    {
+	return;
+    }
+
+    profile->span = last->path;
+    profile->parallelism = profile->span ? (double) profile->work / profile->span : 0;
+    profile->ideal = profile->work / workers > profile->span ? profile->work / workers : profile->span;
+    profile->overhead = profile->ideal ? (double) elapsed / profile->ideal - 1 : 0;
+
+    for (i = last; i; i = i->critical ? profile_find(pool, i->critical) : NULL)
+    {
+	size_t at = profile->critical_count;
+
+	while (at && profile->critical[at - 1].time < i->time)
+	{
+	    if (at < THREAD_POOL_PROFILE_TOP)
+	    {
+		profile->critical[at] = profile->critical[at - 1];
+	    }
+	    
+	    at--;
+	}
+
+	if (at < THREAD_POOL_PROFILE_TOP)
+	{
+	    profile->critical[at] = (thread_pool_profile_job){ i->function, i->time };
+	    
+	    if (profile->critical_count < THREAD_POOL_PROFILE_TOP)
+	    {
+		profile->critical_count++;
+	    }
+	}
+    }
+}
+
+void thread_pool_profile_print(const thread_pool_profile * profile)
+{
+    printf("%zu jobs on %zu workers in %.3f ms\n", profile->jobs, profile->workers, profile->elapsed / 1e6);
+    printf("work %.3f ms, span %.3f ms, parallelism %.2f\n", profile->work / 1e6, profile->span / 1e6, profile->parallelism);
+    printf("ideal %.3f ms, scheduler overhead %.1f%%\n", profile->ideal / 1e6, profile->overhead * 100);
+
+    for (size_t i = 0; i < profile->critical_count; i++)
+    {
+	printf("critical %p %.3f ms\n", (void*) profile->critical[i].function, profile->critical[i].time / 1e6);
+    }
+}
+
+void thread_pool_host(size_t worker_count, thread_job * first_job)
+{
+    thread_pool_host_options(&(thread_pool_options){ .worker_count = worker_count }, first_job);
+}
+
+void thread_pool_host_options(const thread_pool_options * options, thread_job * first_job)
+{
+    size_t worker_count = options->worker_count;
+    
+    thread_pool pool = {0};
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    
+    pthread_mutex_init(&pool.mutex,NULL);
+    pthread_cond_init(&pool.cond,&cond_attr);
+    pthread_cond_init(&pool.space_cond,NULL);
+    pthread_cond_init(&pool.sync_cond,NULL);
+
+    pthread_condattr_destroy(&cond_attr);
+
+    pool.queue_capacity = options->queue_capacity;
+    pool.fail_when_full = options->fail_when_full;
+    pool.host = pthread_self();
+    pool.pin_workers = options->pin_workers;
+
+    if (pool.pin_workers)
+    {
+	// taken here rather than per worker, since workers spawned by pinned workers inherit a single CPU
+	if (sched_getaffinity(0, sizeof(pool.pin_cpus), &pool.pin_cpus) || !(pool.pin_cpu_count = CPU_COUNT(&pool.pin_cpus)))
+	{
+	    log_error("Failed to read the CPUs to pin workers to, leaving them unpinned");
+	    pool.pin_workers = false;
+	}
+    }
+    pool.schedule = options->schedule;
+    pool.random_state = 0x9e3779b97f4a7c15;
+    pool.profile = options->profile;
+
+    if (pool.profile)
+    {
+	pool.profile_shared = profile_buffer_new(&pool);
+    }
+    pool.default_group.weight = 1;
+    pool.default_group.stride = THREAD_JOB_GROUP_STRIDE;
+
+    if (options->max_workers)
+    {
+	pool.min_workers = options->min_workers ? options->min_workers : 1;
+	pool.max_workers = options->max_workers;
+	pool.grow_queue_depth = options->grow_queue_depth ? options->grow_queue_depth : 4;
+	pool.idle_timeout = options->idle_timeout ? options->idle_timeout : 1000000000;
+	
+	if (worker_count < pool.min_workers)
+	{
+	    worker_count = pool.min_workers;
+	}
+	
+	if (worker_count > pool.max_workers)
+	{
+	    worker_count = pool.max_workers;
+	}
+    }
+
+    pool.live_workers = 1;
+
+    lock(&pool);
+    
+    while (pool.live_workers < worker_count)
+    {
+	spawn_worker(&pool);
+    }
+
+    unlock(&pool);
+
+    uint64_t start = monotonic_now();
+
+    thread_pool_add_job(&pool, first_job);
+
+    worker_function(&pool);
+
+    lock(&pool);
+
+    while (!range_is_empty(pool.workers.region))
+    {
+	pthread_t thread = *--pool.workers.region.end;
+	unlock(&pool);
+	pthread_join(thread, NULL);
+	lock(&pool);
+    }
+
+    reap_retired(&pool);
+
+    unlock(&pool);
+
+    if (pool.io.started)
+    {
+	io_stop(&pool.io);
+	worker_function(&pool); // run anything released by I/O that completed while quitting
+    }
+
+    if (pool.deferred)
+    {
+	thread_memory_epoch_flush(); // workers have exited, orphaning what they deferred
+    }
+
+    if (options->profile)
+    {
+	profile_report(&pool, options->profile, monotonic_now() - start, worker_count);
+    }
+
+    assert(!pool.queued);
+    assert(range_is_empty(pool.timers.region));
+
+    thread_job_group ** group;
+
+    for_range(group, pool.groups.region)
+    {
+	(*group)->pool = NULL;
+    }
+
+    window_clear(pool.groups);
+    window_clear(pool.default_group.jobs);
+    window_thread_job_p * domain;
+
+    for_range(domain, pool.domains.region)
+    {
+	window_clear(*domain);
+    }
+
+    window_clear(pool.domains);
+    window_clear(pool.worker_slots);
+    window_clear(pool.timers);
+    window_clear(pool.workers);
+    window_clear(pool.retired);
+    thread_job_profile_buffer ** buffer;
+
+    for_range(buffer, pool.profiles.region)
+    {
+	window_clear((*buffer)->records);
+	free(*buffer);
+    }
+    
+    window_clear(pool.profiles);
+
+    pthread_mutex_destroy(&pool.mutex);
+    pthread_cond_destroy(&pool.cond);
+    pthread_cond_destroy(&pool.space_cond);
+    pthread_cond_destroy(&pool.sync_cond);
+}
+
+void thread_pool_quit(thread_pool * pool)
+{
+    lock(pool);
+    pool->should_quit = true;
+    unlock(pool);
+    broadcast(pool);
+}
+
+thread_job_memory_pool * thread_job_memory_pool_new(size_t arg_size)
+{
+    return (thread_job_memory_pool*) thread_memory_pool_new(sizeof(thread_job) + arg_size);
+}
+
+thread_job_memory_pool * thread_job_memory_pool_new_options(size_t arg_size, const thread_memory_pool_options * options)
+{
+    return (thread_job_memory_pool*) thread_memory_pool_new_options(sizeof(thread_job) + arg_size, options);
+}
+
+void thread_job_add_child(thread_job * parent, thread_job * child)
+{
+    assert(parent);
+    assert(child);
+
+    thread_job_parents * parents = &child->parents;
+    
+    if (parents->count < THREAD_JOB_INLINE_PARENTS)
+    {
+	parents->first[parents->count] = parent;
+    }
+    else
+    {
+	size_t block_index = (parents->count - THREAD_JOB_INLINE_PARENTS) % THREAD_JOB_PARENT_BLOCK_SIZE;
+
+	if (!block_index)
+	{
+	    pthread_once(&parent_block_init_once, thread_job_parent_block_memory_calloc_init);
+	    thread_job_parent_block * block = thread_job_parent_block_memory_calloc();
+	    thread_job_parent_block_memory_unlock(block);
+	    block->peer = parents->more;
+	    parents->more = block;
+	}
+
+	parents->more->parents[block_index] = parent;
+    }
+
+    parents->count++;
+    parent->dependency_count++;
+
+    if (!child->cancel_token && parent->cancel_token)
+    {
+	thread_job_set_cancel_token(child, parent->cancel_token);
+    }
+
+    if (!child->group)
+    {
+	child->group = parent->group;
+    }
+}
+
+void * thread_job_init(thread_job * child, thread_job_function function)
+{
+    assert (!child->function);
+    
+    child->function = function;
+
+    return child + 1;
+}
+
+void thread_job_add_dependency(thread_job * job)
+{
+    job->dependency_count++;
+}
+
+void thread_job_release(thread_pool * pool, thread_job * job)
+{
+    start_parent(pool, job, 0, 0);
+}
+
+void thread_task_spawn(thread_pool * pool, thread_task_scope * scope, thread_task * task, thread_task_function function, void * arg)
+{
+    *task = (thread_task){ .function = function, .arg = arg, .scope = scope };
+    
+    atomic_fetch_add_explicit(&scope->pending, 1, memory_order_relaxed);
+
+    if (worker_pool != pool || !deque_push(&current_worker->deque, task))
+    {
+	run_task(pool, task);
+	return;
+    }
+
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (atomic_load_explicit(&pool->thieves, memory_order_relaxed))
+    {
+	lock(pool);
+
+	if (pool->idle_workers)
+	{
+	    signal(pool);
+	}
+	else
+	{
+	    pthread_cond_signal(&pool->sync_cond); // the thief is a parked syncer
+	}
+	
+	unlock(pool);
+    }
+}
+
+void thread_task_sync(thread_pool * pool, thread_task_scope * scope)
+{
+    thread_task * task;
+    size_t misses = 0;
+    
+    while (atomic_load_explicit(&scope->pending, memory_order_acquire))
+    {
+	if (worker_pool == pool && (task = deque_take(&current_worker->deque)))
+	{
+	    run_task(pool, task);
+	    continue;
+	}
+
+	lock(pool);
+	task = steal_task(pool);
+
+	if (!task && ++misses > THREAD_TASK_SYNC_SPINS)
+	{
+	    // park rather than keep taking the pool lock while the stolen tasks run elsewhere
+	    atomic_fetch_add(&pool->parked_syncers, 1);
+	    atomic_fetch_add(&pool->thieves, 1);
+
+	    if (atomic_load(&scope->pending) && !(task = steal_task(pool)))
+	    {
+		pthread_cond_wait(&pool->sync_cond, &pool->mutex);
+	    }
+
+	    atomic_fetch_sub(&pool->thieves, 1);
+	    atomic_fetch_sub(&pool->parked_syncers, 1);
+	}
+	
+	unlock(pool);
+
+	if (task)
+	{
+	    misses = 0;
+	    run_task(pool, task);
+	}
+	else if (misses <= THREAD_TASK_SYNC_SPINS)
+	{
+	    sched_yield();
+	}
+    }
+}
+
+bool thread_pool_help(thread_pool * pool)
+{
+    thread_job * job;
+    
+    if (worker_pool == pool && current_worker && !range_is_empty(current_worker->cache.region))
+    {
+	job = *current_worker->cache.region.begin++; // the rest of the caller's batch, which no other worker can reach
+    }
+    else
+    {
+	lock(pool);
+
+	job = pool->queued ? queue_pop(pool) : NULL;
+
+	if (!job)
+	{
+	    unlock(pool);
+	    return false;
+	}
+
+	if (pool->full_waiters)
+	{
+	    pthread_cond_broadcast(&pool->space_cond);
+	}
+    
+	unlock(pool);
+    }
+
+    thread_job_memory_lock(job);
+
+    if (job->dependency_count)
+    {
+	thread_job_memory_unlock(job);
+    }
+    else
+    {
+	run_job(pool, job);
+    }
+
+    return true;
+}
+
+void * thread_job_get_arg(thread_job * job)
+{
+    return job + 1;
+}
+
+bool thread_pool_should_quit(thread_pool * pool)
+{
+    return pool->should_quit;
+}
+
+void thread_job_wait(thread_pool * pool, thread_job * job)
+{
+    assert(!job->graph);
+    
+    job->waited = true;
+
+    assert(!job->finished);
+
+    if (!job->dependency_count)
+    {
+	lock(pool);
+	assert(!is_in(&group_of(pool, job)->jobs.region, job));
+	queue_push(pool, job);
+	unlock(pool);
+    }
+    else
+    {
+	//assert(is_in(&group_of(pool, job)->jobs.region, job));
+    }
+    
+    while (!job->finished)
+    {
+	thread_job_memory_wait(job);
+    }
+
+    thread_job_free(job);
+}
+
+thread_job_graph * thread_job_graph_new()
+{
+    return calloc(1, sizeof(thread_job_graph));
+}
+
+void thread_job_graph_add(thread_job_graph * graph, thread_job * job)
+{
+    assert(!graph->sealed);
+    assert(!job->graph);
+    assert(!job->waited);
+    
+    job->graph = graph;
+    *window_push(graph->jobs) = job;
+    thread_job_memory_unlock(job);
+}
+
+void thread_job_graph_seal(thread_job_graph * graph)
+{
+    assert(!graph->sealed);
+    
+    thread_job ** i;
+
+    for_range(i, graph->jobs.region)
+    {
+	thread_job_memory_lock(*i);
+	
+	*window_push(graph->dependency_counts) = (*i)->dependency_count;
+
+	if (!(*i)->dependency_count)
+	{
+	    *window_push(graph->ready) = *i;
+	}
+	
+	thread_job_memory_unlock(*i);
+    }
+
+    graph->sealed = true;
+}
+
+void thread_job_graph_launch(thread_pool * pool, thread_job_graph * graph, thread_job * done)
+{
+    assert(graph->sealed);
+    assert(!atomic_load(&graph->remaining));
+
+    size_t count = range_count(graph->jobs.region);
+
+    for (size_t i = 0; i < count; i++)
+    {
+	graph->jobs.region.begin[i]->dependency_count = graph->dependency_counts.region.begin[i];
+    }
+
+    graph->done = done;
+
+    if (done)
+    {
+	done->dependency_count++;
+	thread_job_memory_unlock(done);
+    }
+
+    if (!count)
+    {
+	if (done)
+	{
+	    start_parent(pool, done, 0, 0);
+	}
+	
+	return;
+    }
+    
+    atomic_store(&graph->remaining, count);
+    
+    thread_job ** i;
+    
+    lock(pool);
+    
+    for_range(i, graph->ready.region)
+    {
+	queue_push(pool, *i);
+    }
+    
+    unlock(pool);
+    broadcast(pool);
+}
+
+void thread_job_graph_free(thread_job_graph * graph)
+{
+    assert(!atomic_load(&graph->remaining));
+    
+    thread_job ** i;
+
+    for_range(i, graph->jobs.region)
+    {
+	thread_job_memory_lock(*i);
+	free_parent_blocks(&(*i)->parents);
+	thread_job_free(*i);
+    }
+
+    window_clear(graph->jobs);
+    window_clear(graph->dependency_counts);
+    window_clear(graph->ready);
+    free(graph);
+}
+
+thread_cancel_token * thread_cancel_token_new()
+{
+    pthread_once(&cancel_token_init_once, thread_cancel_token_memory_calloc_init);
+    
+    thread_cancel_token * retval = thread_cancel_token_memory_calloc();
+
+    atomic_init(&retval->references, 1);
+    
+    thread_cancel_token_memory_unlock(retval);
+
+    return retval;
+}
+
+void thread_cancel_token_retain(thread_cancel_token * token)
+{
+    atomic_fetch_add_explicit(&token->references, 1, memory_order_relaxed);
+}
+
+void thread_cancel_token_release(thread_cancel_token * token)
+{
+    if (1 == atomic_fetch_sub_explicit(&token->references, 1, memory_order_acq_rel))
+    {
+	thread_cancel_token_memory_lock(token);
+	thread_cancel_token_memory_free(token);
+    }
+}
+
+void thread_cancel_token_cancel(thread_cancel_token * token)
+{
+    atomic_store_explicit(&token->cancelled, true, memory_order_relaxed);
+}
+
+bool thread_cancel_token_is_cancelled(thread_cancel_token * token)
+{
+    return is_cancelled(token);
+}
+
+void thread_job_set_destructor(thread_job * job, thread_job_destructor destructor)
+{
+    job->destructor = destructor;
+}
+
+void thread_job_set_cancel_token(thread_job * job, thread_cancel_token * token)
+{
+    if (token)
+    {
+	thread_cancel_token_retain(token);
+    }
+    
+    if (job->cancel_token)
+    {
+	thread_cancel_token_release(job->cancel_token);
+    }
+
+    job->cancel_token = token;
+}
+
+bool thread_job_should_quit(thread_pool * pool, thread_job * job)
+{
+    return pool->should_quit || is_cancelled(job->cancel_token);
+}
+
+thread_job_group * thread_job_group_new(const char * name, unsigned weight)
+{
+    assert(weight);
+    
+    thread_job_group * retval = calloc(1, sizeof(*retval));
+
+    retval->name = strdup(name);
+    retval->weight = weight;
+    retval->stride = THREAD_JOB_GROUP_STRIDE / weight;
+
+    return retval;
+}
+
+void thread_job_group_free(thread_job_group * group)
+{
+    assert(!group->pool);
+    assert(range_is_empty(group->jobs.region));
+
+    window_clear(group->jobs);
+    free(group->name);
+    free(group);
+}
+
+void thread_job_set_group(thread_job * job, thread_job_group * group)
+{
+    job->group = group;
+}
+
+void thread_job_group_get_stats(thread_job_group * group, thread_job_group_stats * stats)
+{
+    *stats = (thread_job_group_stats){
+	.name = group->name,
+	.weight = group->weight,
+	.queue_depth = atomic_load_explicit(&group->depth, memory_order_relaxed),
+	.jobs_run = atomic_load_explicit(&group->jobs_run, memory_order_relaxed),
+	.cpu_time = atomic_load_explicit(&group->cpu_time, memory_order_relaxed),
+    };
+}
+
+void thread_job_set_affinity(thread_job * job, thread_affinity affinity, size_t target)
+{
+    job->affinity = affinity;
+    job->affinity_target = target;
+}
+
+size_t thread_pool_worker_index(thread_pool * pool)
+{
+    return worker_pool == pool && current_worker ? current_worker->index : SIZE_MAX;
+}
+
+size_t thread_pool_worker_domain(thread_pool * pool)
+{
+    return worker_pool == pool && current_worker ? current_worker->domain : SIZE_MAX;
+}
+
+void thread_job_suspend(thread_job * job)
+{
+    assert(!job->graph);
+    
+    job->suspended = true;
 }
@@ -1,33 +1,301 @@
 #ifndef FLAT_INCLUDES
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
 #include "memory-pool.h"
 #endif
 
 typedef struct thread_pool thread_pool;
 typedef struct thread_job thread_job;
+typedef struct thread_job_graph thread_job_graph;
+typedef struct thread_cancel_token thread_cancel_token;
+typedef struct thread_io thread_io;
+typedef struct thread_job_group thread_job_group;
+typedef struct thread_task thread_task;
+
+typedef enum {
+    THREAD_AFFINITY_NONE,
+    THREAD_AFFINITY_SAME_WORKER, /**< The worker that queues the job, when it is one of the pool's */
+    THREAD_AFFINITY_WORKER, /**< The worker with the target index */
+    THREAD_AFFINITY_DOMAIN, /**< Any worker on the target NUMA node */
+}
+    thread_affinity;
+
+typedef enum {
+    THREAD_SCHEDULE_LIFO, /**< Newest jobs first in batches of up to 100, which keeps recursive spawns depth-first and their memory warm */
+    THREAD_SCHEDULE_FIFO, /**< Oldest jobs first, bounding how long any queued job waits */
+    THREAD_SCHEDULE_RANDOM, /**< Jobs picked at random, so no position in the queue is favoured */
+    THREAD_SCHEDULE_ADAPTIVE, /**< Newest first, taking only a worker's share of the queue so shallow queues are spread across the pool */
+}
+    thread_schedule;
+
+typedef enum {
+    THREAD_IO_READ,
+    THREAD_IO_WRITE,
+}
+    thread_io_op;
+
+struct thread_io {
+    thread_io_op op;
+    int fd;
+    void * buffer;
+    size_t size;
+    long long offset; /**< File offset, or -1 to use and advance the current position as read and write do */
+    long long result; /**< Bytes transferred, or a negated errno, once the parent has been released */
+    thread_job * parent; /**< Set by thread_pool_add_io */
+};
 
 thread_memory_pool_declare_types(thread_job, thread_job);
 thread_memory_pool_declare_concurrency(thread_job);
 
 typedef void (*thread_job_function)(thread_job * self, thread_job * parent, thread_pool * pool, void * arg, bool should_quit);
+typedef void (*thread_job_destructor)(void * arg);
+
+#define THREAD_POOL_PROFILE_TOP 8
+
+typedef struct {
+    thread_job_function function;
+    uint64_t time; /**< Nanoseconds the job spent running */
+}
+    thread_pool_profile_job;
+
+typedef struct {
+    size_t jobs; /**< Jobs that finished */
+    size_t workers; /**< Workers the pool started with */
+    uint64_t elapsed; /**< Wall nanoseconds from hosting the first job to the pool quitting */
+    uint64_t work; /**< Nanoseconds spent running jobs, summed over all of them */
+    uint64_t span; /**< Nanoseconds along the longest chain of jobs each released by the one before */
+    double parallelism; /**< Work over span, the most workers the jobs could have kept busy */
+    uint64_t ideal; /**< Elapsed time of a perfect scheduler on this many workers, the larger of work per worker and span */
+    double overhead; /**< Elapsed time over ideal, less one */
+    size_t critical_count; /**< Entries used in critical */
+    thread_pool_profile_job critical[THREAD_POOL_PROFILE_TOP]; /**< The longest running jobs on the critical path, longest first */
+}
+    thread_pool_profile;
+
+void thread_pool_profile_print(const thread_pool_profile * profile);
+/**<
+   Prints a profile to stdout
+*/
+
+typedef struct {
+    size_t worker_count; /**< Number of workers, including the thread calling thread_pool_host_options */
+    size_t queue_capacity; /**< Most jobs the ready queue holds before thread_pool_add_job pushes back, or 0 for no limit */
+    bool fail_when_full; /**< Make thread_pool_add_job fail rather than block when called from outside the pool on a full queue */
+    size_t max_workers; /**< Enables elastic scaling up to this many workers when nonzero, worker_count is then the starting size */
+    size_t min_workers; /**< Elastic pools never retire below this many workers, defaulting to 1 */
+    size_t grow_queue_depth; /**< Elastic pools add a worker when no worker is idle and the queue holds more than this many jobs per worker, defaulting to 4 */
+    uint64_t idle_timeout; /**< Nanoseconds a worker of an elastic pool stays idle before retiring, defaulting to one second */
+    bool pin_workers; /**< Pin each spawned worker to one of the CPUs the host may run on, round robin by worker index, so domains stay put */
+    thread_schedule schedule; /**< Order in which jobs leave the ready queue. Jobs queued with affinity keep their own order */
+    thread_pool_profile * profile; /**< When set, every job is timed along with the longest chain of children it waited on, and this is filled in before thread_pool_host_options returns */
+}
+    thread_pool_options;
 
 void thread_pool_host(size_t worker_count, thread_job * first_job);
+void thread_pool_host_options(const thread_pool_options * options, thread_job * first_job);
 void thread_pool_quit(thread_pool * pool);
 thread_job_memory_pool * thread_job_memory_pool_new(size_t arg_size);
-void thread_pool_add_job(thread_pool * pool, thread_job * job);
+thread_job_memory_pool * thread_job_memory_pool_new_options(size_t arg_size, const thread_memory_pool_options * options);
+bool thread_pool_add_job(thread_pool * pool, thread_job * job);
+/**<
+   Queues a locked job and unlocks it. When the queue is at capacity, a worker of the pool runs the job inline instead, unless the job still has dependencies or a parent the worker is running, in which case it is queued over capacity. Other threads block until there is room or, if the pool fails when full, get false back and keep the locked job
+*/
 void * thread_job_init(thread_job * child, thread_job_function function);
+void * thread_job_get_arg(thread_job * job);
 size_t thread_pool_job_count(thread_pool * pool);
+size_t thread_pool_worker_count(thread_pool * pool);
 void thread_job_wait(thread_pool * pool, thread_job * job);
 void thread_job_add_child(thread_job * parent, thread_job * child);
+/**<
+   Makes parent wait on child. A child may have any number of parents, each of which it releases when it ends. A child without a cancel token inherits the parent's
+*/
+
+thread_cancel_token * thread_cancel_token_new();
+/**<
+   Creates a cancel token holding one reference for the caller
+*/
+
+void thread_cancel_token_retain(thread_cancel_token * token);
+void thread_cancel_token_release(thread_cancel_token * token);
+
+void thread_cancel_token_cancel(thread_cancel_token * token);
+/**<
+   Cancels every job holding the token. Queued jobs are skipped but still release their parents, running jobs see it through thread_job_should_quit
+*/
+
+bool thread_cancel_token_is_cancelled(thread_cancel_token * token);
+
+void thread_job_set_cancel_token(thread_job * job, thread_cancel_token * token);
+/**<
+   Attaches a token to a job, which keeps its own reference to it
+*/
+
+void thread_job_set_destructor(thread_job * job, thread_job_destructor destructor);
+/**<
+   Has the job's arg destroyed when the job's memory is freed. That is once, however many times the job ran, including never, when it was cancelled
+*/
+
+bool thread_job_should_quit(thread_pool * pool, thread_job * job);
+/**<
+   True if the pool is quitting or the job's cancel token has been cancelled
+*/
+
+void thread_job_add_dependency(thread_job * job);
+/**<
+   Makes a locked job wait for one more call to thread_job_release
+*/
+
+void thread_job_release(thread_pool * pool, thread_job * job);
+/**<
+   Removes one dependency from an unlocked job, queuing it once none are left
+*/
+
+void thread_job_suspend(thread_job * job);
+/**<
+   Called by a running job to end this run without finishing. The job keeps its arg and parents and is queued again once the children it added during the run have finished, or right away if it added none. Graph jobs cannot suspend
+*/
+
+void thread_pool_add_job_at(thread_pool * pool, thread_job * job, const struct timespec * deadline);
+/**<
+   Queues a locked job once the CLOCK_MONOTONIC deadline passes and unlocks it. Idle workers sleep until the earliest deadline instead of needing a timer thread
+*/
+
+void thread_pool_add_job_after(thread_pool * pool, thread_job * job, uint64_t nanoseconds);
+/**<
+   Queues a locked job after the given delay and unlocks it
+*/
+
+void thread_pool_add_job_every(thread_pool * pool, thread_job * job, uint64_t nanoseconds);
+/**<
+   Runs a locked job at a fixed interval, starting one interval from now. The job keeps repeating until its cancel token is cancelled or the pool quits, and only then ends and releases its parents
+*/
+
+void thread_pool_add_io(thread_pool * pool, thread_io * io, thread_job * parent);
+/**<
+   Submits a read or write that holds a dependency on the locked parent until it completes, without taking a worker out of the pool. Requests go to an io_uring owned by the pool, or to an I/O thread when io_uring is unavailable. The request must stay valid until the parent runs
+*/
+
+bool thread_pool_help(thread_pool * pool);
+/**<
+   Runs one queued job on the calling thread, returning false if the queue was empty. A worker first runs what is left of the batch it took from the queue
+*/
+
+typedef void (*thread_task_function)(thread_pool * pool, void * arg);
+
+typedef struct {
+#ifdef __cplusplus
+    size_t pending; // atomic on the C side, C++ only reaches it through thread_task_spawn and thread_task_sync
+#else
+    _Atomic size_t pending;
+#endif
+}
+    thread_task_scope; /**< Join counter for tasks spawned by one frame, zero initialized on the spawner's stack */
+
+struct thread_task {
+    thread_task_function function;
+    void * arg;
+    thread_task_scope * scope;
+}; /**< A spawned task, owned by the spawner's stack until its scope is synced */
+
+void thread_task_spawn(thread_pool * pool, thread_task_scope * scope, thread_task * task, thread_task_function function, void * arg);
+/**<
+   Pushes a task on the calling worker's local deque where idle workers may steal it. Runs it inline when called from outside the pool's workers or when the deque is full
+*/
+
+void thread_task_sync(thread_pool * pool, thread_task_scope * scope);
+/**<
+   Runs tasks from the local deque, then steals from other workers, until every task spawned in the scope has finished. Tasks and their args must stay alive until this returns
+*/
+
+typedef struct {
+    const char * name;
+    unsigned weight;
+    size_t queue_depth; /**< Jobs of the group waiting in the ready queue */
+    size_t jobs_run; /**< Jobs taken from the ready queue so far */
+    uint64_t cpu_time; /**< Thread CPU nanoseconds spent running the group's jobs */
+}
+    thread_job_group_stats;
+
+thread_job_group * thread_job_group_new(const char * name, unsigned weight);
+/**<
+   Creates a group of jobs that gets a share of the pool's workers proportional to its weight while it has jobs ready. Jobs without a group share the pool's default group of weight 1
+*/
+
+void thread_job_group_free(thread_job_group * group);
+/**<
+   Frees a group once the pool it was used with has returned from thread_pool_host
+*/
+
+void thread_job_set_group(thread_job * job, thread_job_group * group);
+/**<
+   Puts a job in a group. Children added to it with thread_job_add_child inherit the group unless they were given one
+*/
+
+void thread_job_set_affinity(thread_job * job, thread_affinity affinity, size_t target);
+/**<
+   Hints where a job should run each time it is queued. The worker or domain it names takes it before shared jobs, idle workers take it over only while the owner is busy with more queued for it. A hint naming no running worker is ignored
+*/
+
+size_t thread_pool_worker_index(thread_pool * pool);
+/**<
+   Returns the index of the calling worker, 0 being the thread hosting the pool, or SIZE_MAX outside the pool's workers
+*/
+
+size_t thread_pool_worker_domain(thread_pool * pool);
+/**<
+   Returns the NUMA node the calling worker was on when it started, or SIZE_MAX outside the pool's workers
+*/
+
+void thread_job_group_get_stats(thread_job_group * group, thread_job_group_stats * stats);
+
+thread_job_graph * thread_job_graph_new();
+/**<
+   Creates an empty graph of jobs that can be launched repeatedly
+*/
+
+void thread_job_graph_add(thread_job_graph * graph, thread_job * job);
+/**<
+   Hands a locked, initialized job over to the graph, which unlocks it and keeps it across launches. Edges between jobs of the graph are added with thread_job_add_child before the graph is sealed
+*/
+
+void thread_job_graph_seal(thread_job_graph * graph);
+/**<
+   Records the dependency count of every job and the set of jobs that are ready at launch. No jobs or edges may be added afterwards
+*/
+
+void thread_job_graph_launch(thread_pool * pool, thread_job_graph * graph, thread_job * done);
+/**<
+   Resets the dependency counts of a sealed graph and queues its ready jobs without allocating. If done is given, it is a locked job that is unlocked here and started once every job of the graph has run. A graph may only be launched again after its previous run has finished
+*/
+
+void thread_job_graph_free(thread_job_graph * graph);
+/**<
+   Frees an idle graph along with all of its jobs
+*/
+
+#define thread_job_resume(state)			\
+    switch (state) { case 0:
+/**<
+   Opens the body of a resumable job whose progress is kept in an int state field of its arg, starting at 0
+*/
+
+#define thread_job_yield(self, state)					\
+    do { (state) = __LINE__; thread_job_suspend((thread_job*)(self)); return; case __LINE__:; } while (0)
+/**<
+   Suspends a resumable job until the children it added have finished, continuing from this point when it runs again. Locals do not survive, keep what is needed in the arg
+*/
+
+#define thread_job_resume_end }
 
 #define thread_job_declare(name)					\
 									\
     typedef struct name##_job name##_job;				\
 									\
-    inline static void thread_pool_add_##name##_job(thread_pool * pool, name##_job * job) \
+    inline static bool thread_pool_add_##name##_job(thread_pool * pool, name##_job * job) \
     {									\
-	thread_pool_add_job(pool, (thread_job*) job);			\
+	return thread_pool_add_job(pool, (thread_job*) job);		\
     }									\
 									\
     inline static thread_job * name##_job_generic(name##_job * job)	\
@@ -62,11 +330,21 @@ void thread_job_add_child(thread_job * parent, thread_job * child);
 	return thread_job_init((thread_job*)child, name##_job_function); \
     }									\
 									\
+    inline static name##_job_arg * name##_job_get_arg(name##_job * job) \
+    {									\
+	return thread_job_get_arg((thread_job*)job);			\
+    }									\
+									\
     name##_job_memory_pool * name##_job_memory_pool_new()		\
     {									\
 	return (name##_job_memory_pool*) thread_job_memory_pool_new(sizeof(name##_job_arg)); \
     }									\
 									\
+    name##_job_memory_pool * name##_job_memory_pool_new_options(const thread_memory_pool_options * options) \
+    {									\
+	return (name##_job_memory_pool*) thread_job_memory_pool_new_options(sizeof(name##_job_arg), options); \
+    }									\
+									\
     thread_memory_pool_define_default_alloc(name##_job);		\
 
 #define thread_job_define_function(name)				\
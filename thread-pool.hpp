@@ -0,0 +1,210 @@
+#ifndef FLAT_INCLUDES
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <new>
+#include <type_traits>
+#include <utility>
+extern "C" {
+#include "memory-pool.h"
+#include "thread-pool.h"
+}
+#endif
+
+namespace thread
+{
+    class pool_ref
+    {
+	thread_pool * pool_;
+
+    public:
+	explicit pool_ref(thread_pool * pool) : pool_(pool) {}
+
+	thread_pool * get() const { return pool_; }
+
+	bool add(thread_job * job) const { return thread_pool_add_job(pool_, job); }
+	/**< Queues a locked job made by a job_pool or by the C API */
+
+	template<typename F> bool add(F && function) const;
+	/**< Makes a job from the shared pool for the callable's type and queues it */
+
+	void quit() const { thread_pool_quit(pool_); }
+
+	bool help() const { return thread_pool_help(pool_); }
+
+	std::size_t worker_index() const { return thread_pool_worker_index(pool_); }
+    };
+
+    struct job_context
+    {
+	thread_job * self;
+	thread_job * parent;
+	pool_ref pool;
+	bool should_quit;
+    };
+
+    template<typename T>
+    class memory_pool
+    {
+	thread_memory_pool * pool_;
+
+	static_assert(alignof(T) <= alignof(std::max_align_t), "memory pool items are only aligned to max_align_t");
+
+    public:
+	static constexpr std::size_t item_size = sizeof(T);
+
+	memory_pool() : pool_(thread_memory_pool_new(item_size)) {}
+	explicit memory_pool(const thread_memory_pool_options & options) : pool_(thread_memory_pool_new_options(item_size, &options)) {}
+	~memory_pool() { if (pool_) thread_memory_pool_free(pool_); }
+
+	memory_pool(const memory_pool &) = delete;
+	memory_pool & operator=(const memory_pool &) = delete;
+	memory_pool(memory_pool && other) noexcept : pool_(std::exchange(other.pool_, nullptr)) {}
+	memory_pool & operator=(memory_pool && other) noexcept { std::swap(pool_, other.pool_); return *this; }
+
+	thread_memory_pool * get() const { return pool_; }
+
+	void reserve(std::size_t count) { thread_memory_pool_reserve(pool_, count); }
+
+	thread_memory_pool_stats stats() const
+	{
+	    thread_memory_pool_stats retval;
+	    thread_memory_pool_get_stats(pool_, &retval);
+	    return retval;
+	}
+
+	template<typename... A> T * make(A &&... args)
+	{
+	    return new (thread_memory_pool_calloc_from_pool(pool_)) T(std::forward<A>(args)...);
+	}
+	/**< Constructs an object in pooled memory, returned locked like the C allocator's items */
+
+	static void destroy(T * object)
+	{
+	    object->~T();
+	    thread_memory_free(object);
+	}
+	/**< Destroys a locked object and returns its memory to its pool */
+    };
+
+    template<typename F>
+    class job_pool
+    {
+	thread_job_memory_pool * pool_;
+
+	static_assert(alignof(F) <= alignof(void*), "job arguments follow the job header and are only pointer aligned");
+
+	static void run(thread_job * self, thread_job * parent, thread_pool * pool, void * arg, bool should_quit)
+	{
+	    F & function = *static_cast<F*>(arg);
+
+	    if constexpr (std::is_invocable_v<F&, const job_context &>)
+	    {
+		function(job_context{ self, parent, pool_ref(pool), should_quit });
+	    }
+	    else if constexpr (std::is_invocable_v<F&, pool_ref>)
+	    {
+		function(pool_ref(pool));
+	    }
+	    else
+	    {
+		static_assert(std::is_invocable_v<F&>, "a job takes a job_context, a pool_ref or nothing");
+		function();
+	    }
+	}
+
+	static void destroy(void * arg)
+	{
+	    static_cast<F*>(arg)->~F();
+	}
+
+    public:
+	static constexpr std::size_t arg_size = sizeof(F);
+
+	job_pool() : pool_(thread_job_memory_pool_new(arg_size)) {}
+	explicit job_pool(const thread_memory_pool_options & options) : pool_(thread_job_memory_pool_new_options(arg_size, &options)) {}
+	~job_pool() { if (pool_) thread_memory_pool_free(reinterpret_cast<thread_memory_pool*>(pool_)); }
+
+	job_pool(const job_pool &) = delete;
+	job_pool & operator=(const job_pool &) = delete;
+	job_pool(job_pool && other) noexcept : pool_(std::exchange(other.pool_, nullptr)) {}
+	job_pool & operator=(job_pool && other) noexcept { std::swap(pool_, other.pool_); return *this; }
+
+	thread_job_memory_pool * get() const { return pool_; }
+
+	thread_job * make(F function) const
+	{
+	    thread_job * job = static_cast<thread_job*>(thread_memory_pool_calloc_from_pool(reinterpret_cast<thread_memory_pool*>(pool_)));
+	    new (thread_job_init(job, &run)) F(std::move(function));
+
+	    if constexpr (!std::is_trivially_destructible_v<F>)
+	    {
+		thread_job_set_destructor(job, &destroy);
+	    }
+	    
+	    return job;
+	}
+	/**< Returns a locked job holding the callable inline, destroyed when the job is freed, usable with every thread_job function of the C API */
+
+	static job_pool & shared()
+	{
+	    static job_pool retval;
+	    return retval;
+	}
+	/**< The pool used for callables of this type when no pool is given */
+    };
+
+    template<typename F> thread_job * make_job(F && function)
+    {
+	return job_pool<std::decay_t<F>>::shared().make(std::forward<F>(function));
+    }
+
+    template<typename F> bool pool_ref::add(F && function) const
+    {
+	return thread_pool_add_job(pool_, make_job(std::forward<F>(function)));
+    }
+
+    template<typename F>
+    struct task
+    {
+	thread_task record;
+	F function;
+
+	explicit task(F function) : function(std::move(function)) {}
+
+	static void run(thread_pool * pool, void * arg)
+	{
+	    static_cast<task*>(arg)->function(pool_ref(pool));
+	}
+    }; /**< A fork/join task kept on the spawner's stack alongside its callable */
+
+    class task_scope
+    {
+	thread_pool * pool_;
+	thread_task_scope scope_ = {};
+
+    public:
+	explicit task_scope(pool_ref pool) : pool_(pool.get()) {}
+	~task_scope() { sync(); }
+
+	task_scope(const task_scope &) = delete;
+	task_scope & operator=(const task_scope &) = delete;
+
+	template<typename F> void spawn(task<F> & task)
+	{
+	    thread_task_spawn(pool_, &scope_, &task.record, &thread::task<F>::run, &task);
+	}
+
+	void sync() { thread_task_sync(pool_, &scope_); }
+    }; /**< Syncs on destruction, so tasks spawned in it cannot outlive their frame */
+
+    template<typename F> void host(const thread_pool_options & options, F && first)
+    {
+	thread_pool_host_options(&options, make_job(std::forward<F>(first)));
+    }
+
+    template<typename F> void host(std::size_t worker_count, F && first)
+    {
+	thread_pool_host(worker_count, make_job(std::forward<F>(first)));
+    }
+}